@@ -187,7 +187,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb_page_addr0(tb) == desc->page_addr0 &&
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
-        tb_cflags(tb) == desc->cflags) {
+        tb_key_cflags(tb) == desc->cflags) {
         /* check next page if needed */
         tb_page_addr_t tb_phys_page1 = tb_page_addr1(tb);
         if (tb_phys_page1 == -1) {
@@ -261,7 +261,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    jc->array[hash].pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   tb_key_cflags(tb) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -279,7 +279,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    tb->pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   tb_key_cflags(tb) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -713,6 +713,24 @@ static inline void cpu_handle_debug_exception(CPUState *cpu)
     }
 }
 
+#ifndef CONFIG_USER_ONLY
+/*
+ * PC reported to plugins around an interrupt or exception; targets
+ * without a get_pc hook report 0.
+ */
+static vaddr cpu_discon_pc(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+
+    return cc->get_pc ? cc->get_pc(cpu) : 0;
+}
+
+static inline bool cpu_discon_enabled(CPUState *cpu)
+{
+    return test_bit(QEMU_PLUGIN_EV_VCPU_DISCON, cpu->plugin_mask);
+}
+#endif
+
 static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 {
     if (cpu->exception_index < 0) {
@@ -749,11 +767,21 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #else
         if (replay_exception()) {
             CPUClass *cc = CPU_GET_CLASS(cpu);
+            bool discon = cpu_discon_enabled(cpu);
+            int cause = cpu->exception_index;
+            vaddr from_pc = discon ? cpu_discon_pc(cpu) : 0;
+
             qemu_mutex_lock_iothread();
             cc->tcg_ops->do_interrupt(cpu);
             qemu_mutex_unlock_iothread();
             cpu->exception_index = -1;
 
+            if (unlikely(discon)) {
+                qemu_plugin_vcpu_discon_cb(cpu, QEMU_PLUGIN_DISCON_EXCEPTION,
+                                           cause, from_pc,
+                                           cpu_discon_pc(cpu));
+            }
+
             if (icount_enabled()) {
                 // we must consume at least one icount insn on each trap; if we don't, we could get
                 // into a trap loop that prevents virtual time from ever advancing.
@@ -872,12 +900,29 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
            and via longjmp via cpu_loop_exit.  */
         else {
             CPUClass *cc = CPU_GET_CLASS(cpu);
+            bool discon = cpu_discon_enabled(cpu);
+            vaddr from_pc = discon ? cpu_discon_pc(cpu) : 0;
 
+            cpu->delivered_interrupt = -1;
             if (cc->tcg_ops->cpu_exec_interrupt &&
                 cc->tcg_ops->cpu_exec_interrupt(cpu, interrupt_request)) {
                 if (need_replay_interrupt(interrupt_request)) {
                     replay_interrupt();
                 }
+                if (unlikely(discon)) {
+                    /*
+                     * Targets that do not record the interrupt leave its
+                     * number in exception_index.
+                     */
+                    int32_t cause = cpu->delivered_interrupt != -1 ?
+                                    cpu->delivered_interrupt :
+                                    cpu->exception_index;
+
+                    qemu_plugin_vcpu_discon_cb(cpu,
+                                               QEMU_PLUGIN_DISCON_INTERRUPT,
+                                               cause, from_pc,
+                                               cpu_discon_pc(cpu));
+                }
                 /*
                  * After processing the interrupt, ensure an EXCP_DEBUG is
                  * raised when single-stepping so that GDB doesn't miss the
@@ -971,6 +1016,137 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 #endif
 }
 
+#ifndef CONFIG_USER_ONLY
+/* Blocks translated per round of speculation, see cpu_exec_speculate() */
+#define TB_SPECULATE_BUDGET 32
+/* Longer than the longest instruction of any target */
+#define TB_SPECULATE_PAGE_TAIL 16
+
+/*
+ * Return true if @pc can be translated for @cpu without raising a guest
+ * exception, including a final instruction that crosses into the next
+ * page.  Only pages already in the TLB qualify: a page walk could set
+ * accessed bits for code the guest never ran.
+ */
+static bool cpu_speculate_reachable(CPUState *cpu, vaddr pc)
+{
+    CPUArchState *env = cpu_env(cpu);
+
+    if (get_page_addr_code_tlb(env, pc, NULL) == -1) {
+        return false;
+    }
+    if (-(pc | TARGET_PAGE_MASK) < TB_SPECULATE_PAGE_TAIL &&
+        get_page_addr_code_tlb(env, TARGET_PAGE_ALIGN(pc), NULL) == -1) {
+        return false;
+    }
+    return true;
+}
+
+static bool cpu_speculate_one(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                              uint32_t flags, uint32_t cflags)
+{
+    if (tb_htable_lookup(cpu, pc, cs_base, flags, cflags)) {
+        return false;
+    }
+    mmap_lock();
+    tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    mmap_unlock();
+    return true;
+}
+
+/* Blocks of the profile translated each time a vCPU enters the loop */
+#define TB_PROFILE_BUDGET 64
+
+/*
+ * Pre-warm the translation cache with some of the blocks of the profile
+ * that the guest can reach from its current state, before running it.
+ * Each block is translated from scratch, as on a miss.  The replay is
+ * spread over the entries of the vCPUs into the loop, so that none of
+ * them stalls for the whole profile; with tb-speculate=on halted vCPUs
+ * take their share too.
+ */
+static void cpu_exec_tb_profile(CPUState *cpu)
+{
+    int budget = TB_PROFILE_BUDGET;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags, cflags;
+
+    while (budget && tb_profile_next(cpu, &pc, &cs_base, &flags, &cflags)) {
+        budget -= cpu_speculate_one(cpu, pc, cs_base, flags, cflags);
+    }
+}
+
+/* Return the number of blocks translated, at most TB_SPECULATE_BUDGET. */
+static int cpu_speculate_round(CPUState *cpu)
+{
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    uint32_t cflags = curr_cflags(cpu);
+    int budget = TB_SPECULATE_BUDGET;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags, profile_cflags;
+
+    /* the working set requeued by the last flush comes first */
+    while (budget &&
+           tb_profile_next(cpu, &pc, &cs_base, &flags, &profile_cflags)) {
+        budget -= cpu_speculate_one(cpu, pc, cs_base, flags, profile_cflags);
+    }
+
+    /* then the direct successors of the blocks run most recently */
+    for (int n = 0; budget && n < TB_JMP_CACHE_SIZE; n++) {
+        unsigned i = jc->speculate_pos++ & (TB_JMP_CACHE_SIZE - 1);
+        TranslationBlock *tb = qatomic_read(&jc->array[i].tb);
+
+        if (!tb || tb_key_cflags(tb) != cflags) {
+            continue;
+        }
+        for (int j = 0; j < ARRAY_SIZE(tb->succ_pc); j++) {
+            pc = tb->succ_pc[j];
+            if (budget && pc != (vaddr)-1 &&
+                cpu_speculate_reachable(cpu, pc)) {
+                budget -= cpu_speculate_one(cpu, pc, tb->cs_base,
+                                            tb->flags, cflags);
+            }
+        }
+    }
+    return TB_SPECULATE_BUDGET - budget;
+}
+
+static void cpu_speculate_kick(CPUState *cpu, run_on_cpu_data data)
+{
+}
+
+/*
+ * Use the time of a halted vCPU to translate the blocks the guest is
+ * likely to need next.  The successors are translated with the flags of
+ * the block that jumps to them, which is right for the common case of a
+ * direct jump within the same mode; a wrong guess only costs cache
+ * space.
+ *
+ * Each call does a bounded amount of work.  While there is more to do,
+ * an empty work item keeps the vCPU thread from going to sleep, so that
+ * interrupts and other work are still handled between rounds.
+ */
+static void cpu_exec_speculate(CPUState *cpu)
+{
+    int exception_index = cpu->exception_index;
+
+    rcu_read_lock();
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        if (cpu_speculate_round(cpu) == TB_SPECULATE_BUDGET) {
+            /* there is probably more to do */
+            async_run_on_cpu(cpu, cpu_speculate_kick, RUN_ON_CPU_NULL);
+        }
+    } else {
+        /* tb_gen_code() ran out of space and requested a flush */
+        cpu_exec_longjmp_cleanup(cpu);
+        cpu->exception_index = exception_index;
+    }
+    rcu_read_unlock();
+}
+#endif
+
 /* main execution loop */
 
 static int __attribute__((noinline))
@@ -978,6 +1154,12 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
 {
     int ret;
 
+#ifndef CONFIG_USER_ONLY
+    if (unlikely(qatomic_read(&tb_profile_pending))) {
+        cpu_exec_tb_profile(cpu);
+    }
+#endif
+
     /* if an exception is pending, we execute it here */
     while (!cpu_handle_exception(cpu, &ret)) {
         TranslationBlock *last_tb = NULL;
@@ -1079,6 +1261,11 @@ int cpu_exec(CPUState *cpu)
     current_cpu = cpu;
 
     if (cpu_handle_halt(cpu)) {
+#ifndef CONFIG_USER_ONLY
+        if (tb_speculate && qemu_tcg_mttcg_enabled()) {
+            cpu_exec_speculate(cpu);
+        }
+#endif
         return EXCP_HALTED;
     }
 
@@ -1095,6 +1282,7 @@ int cpu_exec(CPUState *cpu)
 
     ret = cpu_exec_setjmp(cpu, &sc);
 
+    qemu_plugin_vcpu_mem_trace_flush(cpu);
     cpu_exec_exit(cpu);
     rcu_read_unlock();
 
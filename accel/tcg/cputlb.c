@@ -1617,6 +1617,53 @@ tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env, vaddr addr,
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+/*
+ * Like get_page_addr_code_hostp(), but never raises a guest exception:
+ * returns -1 if the guest cannot fetch from @addr right now.
+ */
+tb_page_addr_t get_page_addr_code_nofault(CPUArchState *env, vaddr addr,
+                                          void **hostp)
+{
+    CPUTLBEntryFull *full;
+    void *p;
+    int flags;
+
+    flags = probe_access_internal(env_cpu(env), addr, 1, MMU_INST_FETCH,
+                                  cpu_mmu_index(env, true), true,
+                                  &p, &full, 0, false);
+    if (flags & TLB_INVALID_MASK || p == NULL ||
+        full->lg_page_size < TARGET_PAGE_BITS) {
+        return -1;
+    }
+
+    if (hostp) {
+        *hostp = p;
+    }
+    return qemu_ram_addr_from_host_nofail(p);
+}
+
+/*
+ * Like get_page_addr_code_nofault(), but only for pages already in the
+ * TLB.  Filling the TLB walks the guest page tables, which on some
+ * targets sets accessed bits the guest can see; this must not happen for
+ * code the guest has not asked to run.
+ */
+tb_page_addr_t get_page_addr_code_tlb(CPUArchState *env, vaddr addr,
+                                      void **hostp)
+{
+    CPUState *cpu = env_cpu(env);
+    int mmu_idx = cpu_mmu_index(env, true);
+    uintptr_t index = tlb_index(cpu, mmu_idx, addr);
+    CPUTLBEntry *entry = tlb_entry(cpu, mmu_idx, addr);
+    vaddr page_addr = addr & TARGET_PAGE_MASK;
+
+    if (!tlb_hit_page(tlb_read_idx(entry, MMU_INST_FETCH), page_addr) &&
+        !victim_tlb_hit(cpu, mmu_idx, index, MMU_INST_FETCH, page_addr)) {
+        return -1;
+    }
+    return get_page_addr_code_nofault(env, addr, hostp);
+}
+
 /* Load/store with atomicity primitives. */
 #include "ldst_atomicity.c.inc"
 
@@ -95,6 +95,30 @@ static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 
 extern bool one_insn_per_tb;
 
+extern bool tb_speculate;
+
+/* Tiered translation, see HELPER(tb_promote) */
+extern uint32_t tb_tier_threshold;
+bool tb_tier_is_hot(tb_page_addr_t phys_pc);
+
+/* cflags of blocks that are never counted nor promoted */
+#define TB_TIER_CF_SKIP \
+    (CF_COUNT_MASK | CF_NOIRQ | CF_SINGLE_STEP | CF_MEMI_ONLY)
+
+#ifndef CONFIG_USER_ONLY
+tb_page_addr_t get_page_addr_code_nofault(CPUArchState *env, vaddr addr,
+                                          void **hostp);
+tb_page_addr_t get_page_addr_code_tlb(CPUArchState *env, vaddr addr,
+                                      void **hostp);
+
+/* Persistent translation profile, see tb-profile.c */
+extern bool tb_profile_pending;
+void tb_profile_init(const char *path);
+void tb_profile_requeue(void);
+bool tb_profile_next(CPUState *cpu, vaddr *pc, uint64_t *cs_base,
+                     uint32_t *flags, uint32_t *cflags);
+#endif
+
 /**
  * tcg_req_mo:
  * @type: TCGBar
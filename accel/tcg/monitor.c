@@ -101,6 +101,8 @@ struct tb_tree_stats {
     size_t direct_jmp_count;
     size_t direct_jmp2_count;
     size_t cross_page;
+    size_t invalid_tbs;
+    size_t invalid_host_size;
 };
 
 static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
@@ -110,6 +112,11 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
 
     tst->nb_tbs++;
     tst->host_size += tb->tc.size;
+    /* invalidated TBs keep their code until the next flush */
+    if (tb_cflags(tb) & CF_INVALID) {
+        tst->invalid_tbs++;
+        tst->invalid_host_size += tb->tc.size;
+    }
     tst->target_size += tb->size;
     if (tb->size > tst->max_target_size) {
         tst->max_target_size = tb->size;
@@ -175,6 +182,11 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "cross page TB count %zu (%zu%%)\n",
                            tst.cross_page,
                            nb_tbs ? (tst.cross_page * 100) / nb_tbs : 0);
+    g_string_append_printf(buf, "invalid TB count    %zu (%zu%%) "
+                           "(%zu bytes of host code)\n",
+                           tst.invalid_tbs,
+                           nb_tbs ? (tst.invalid_tbs * 100) / nb_tbs : 0,
+                           tst.invalid_host_size);
     g_string_append_printf(buf, "direct jump count   %zu (%zu%%) "
                            "(2 jumps=%zu %zu%%)\n",
                            tst.direct_jmp_count,
@@ -81,6 +81,7 @@ enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
     PLUGIN_GEN_CB_MEM,
+    PLUGIN_GEN_CB_MEM_VALUE,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
     PLUGIN_GEN_N_CBS,
@@ -93,11 +94,22 @@ enum plugin_gen_cb {
 void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *udata)
 { }
 
+void HELPER(plugin_vcpu_udata_cb_no_wg)(uint32_t cpu_index, void *udata)
+{ }
+
+void HELPER(plugin_vcpu_udata_cb_rw)(uint32_t cpu_index, void *udata)
+{ }
+
 void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 qemu_plugin_meminfo_t info, uint64_t vaddr,
                                 void *userdata)
 { }
 
+void HELPER(plugin_mem_trace_flush)(uint32_t cpu_index, void *trace)
+{
+    plugin_mem_trace_flush(trace, cpu_index);
+}
+
 static void gen_empty_udata_cb(void)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -200,6 +212,27 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     }
 }
 
+/*
+ * The value of an access is only saved for the callbacks and traces that
+ * can read it back, so its stores are wrapped like any other callback and
+ * dropped by plugin_gen_inject() when no such consumer is registered.
+ */
+void plugin_gen_empty_mem_value(TCGv_i64 low, TCGv_i64 high, uint32_t info)
+{
+    enum qemu_plugin_mem_rw rw = get_plugin_meminfo_rw(info);
+
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_MEM_VALUE, rw);
+    tcg_gen_st_i64(low, tcg_env,
+                   -offsetof(ArchCPU, env) +
+                   offsetof(CPUState, plugin_mem_value_low));
+    if (high) {
+        tcg_gen_st_i64(high, tcg_env,
+                       -offsetof(ArchCPU, env) +
+                       offsetof(CPUState, plugin_mem_value_high));
+    }
+    tcg_gen_plugin_cb_end();
+}
+
 void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
 {
     enum qemu_plugin_mem_rw rw = get_plugin_meminfo_rw(info);
@@ -241,6 +274,18 @@ static TCGOp *rm_ops(TCGOp *op)
     return rm_ops_range(op, end_op);
 }
 
+/*
+ * Must be called before the inline placeholder at @begin_op is expanded,
+ * so that the returned op is the first one past the expanded inline ops.
+ */
+static TCGOp *plugin_cb_next_op(TCGOp *begin_op)
+{
+    TCGOp *end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+
+    tcg_debug_assert(end_op);
+    return QTAILQ_NEXT(end_op, link);
+}
+
 static TCGOp *copy_op_nocheck(TCGOp **begin_op, TCGOp *op)
 {
     TCGOp *old_op = QTAILQ_NEXT(*begin_op, link);
@@ -359,6 +404,11 @@ static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *func, int *cb_idx)
 static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
                               TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
+    /* callbacks accessing registers are generated by inject_udata_cb() */
+    if (cb->flags != QEMU_PLUGIN_CB_NO_REGS) {
+        return op;
+    }
+
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
@@ -380,6 +430,11 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
+    /* per-vCPU ops are generated by inject_inline_per_vcpu_cb() */
+    if (cb->inline_insn.entry.score) {
+        return op;
+    }
+
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
@@ -473,12 +528,133 @@ static void inject_cb_type(const GArray *cbs, TCGOp *begin_op,
 static void
 inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
 {
+    int i;
+
+    /*
+     * The template call is flagged TCG_CALL_NO_RWG; callbacks accessing
+     * registers need a call with different flags, so generate those.
+     */
+    if (cbs) {
+        tcg_ctx->emit_before_op = plugin_cb_next_op(begin_op);
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (cb->flags != QEMU_PLUGIN_CB_NO_REGS) {
+                gen_udata_cb(cb);
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+/*
+ * Emit a call to the plugin's udata callback. The call flags follow
+ * the register access the callback declared: TCG globals are synced
+ * back to env before a callback that reads registers, and reloaded
+ * after one that may write them.
+ */
+static void gen_udata_call(const struct qemu_plugin_dyn_cb *cb,
+                           TCGv_i32 cpu_index)
+{
+    TCGv_ptr udata = tcg_constant_ptr(cb->userp);
+    TCGOp *op;
+
+    /* let the register accessors check what the callback declared */
+    if (cb->flags != QEMU_PLUGIN_CB_NO_REGS) {
+        tcg_gen_st_i32(tcg_constant_i32(cb->flags), tcg_env,
+                       -offsetof(ArchCPU, env) +
+                       offsetof(CPUState, plugin_cb_flags));
+    }
+
+    switch (cb->flags) {
+    case QEMU_PLUGIN_CB_R_REGS:
+        gen_helper_plugin_vcpu_udata_cb_no_wg(cpu_index, udata);
+        break;
+    case QEMU_PLUGIN_CB_RW_REGS:
+        gen_helper_plugin_vcpu_udata_cb_rw(cpu_index, udata);
+        break;
+    default:
+        gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+        break;
+    }
+
+    /* point the stub helper call at the plugin's callback */
+    op = tcg_ctx->emit_before_op ?
+        QTAILQ_PREV(tcg_ctx->emit_before_op, link) : tcg_last_op();
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] = (uintptr_t)cb->f.vcpu_udata;
+
+    if (cb->flags != QEMU_PLUGIN_CB_NO_REGS) {
+        tcg_gen_st_i32(tcg_constant_i32(QEMU_PLUGIN_CB_NO_REGS), tcg_env,
+                       -offsetof(ArchCPU, env) +
+                       offsetof(CPUState, plugin_cb_flags));
+    }
+}
+
+static void gen_udata_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_udata_call(cb, cpu_index);
+    tcg_temp_free_i32(cpu_index);
+}
+
+/*
+ * Per-vCPU inline ops have to index the scoreboard with the vCPU's
+ * cpu_index, which the template cannot express, so they are generated
+ * directly, like conditional callbacks.
+ */
+static void gen_inline_per_vcpu_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    struct qemu_plugin_scoreboard *score = cb->inline_insn.entry.score;
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, score->stride);
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_gen_addi_ptr(ptr, ptr,
+                     (intptr_t)score->data + cb->inline_insn.entry.offset);
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void inject_inline_per_vcpu_cb(const GArray *cbs, TCGOp *begin_op,
+                                      TCGOp *next_op, op_ok_fn ok)
+{
+    int i;
+
+    if (!cbs) {
+        return;
+    }
+
+    tcg_ctx->emit_before_op = next_op;
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (cb->inline_insn.entry.score && ok(begin_op, cb)) {
+            gen_inline_per_vcpu_cb(cb);
+        }
+    }
+    tcg_ctx->emit_before_op = NULL;
+}
+
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
+    inject_inline_per_vcpu_cb(cbs, begin_op, plugin_cb_next_op(begin_op), ok);
     inject_cb_type(cbs, begin_op, append_inline_cb, ok);
 }
 
@@ -488,6 +664,171 @@ inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_mem_cb, op_rw);
 }
 
+/*
+ * Memory trace records are written by the translated code itself. An
+ * instruction with traced accesses first makes sure the vCPU's buffer
+ * has room for all of them, calling the flush helper otherwise, so that
+ * the stores following each access need no check of their own.
+ */
+static void gen_mem_trace_cursor(TCGv_ptr cursor, TCGv_i32 cpu_index,
+                                 const struct qemu_plugin_mem_trace *trace)
+{
+    TCGv_i32 off = tcg_temp_ebb_new_i32();
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(off, cpu_index, trace->cursors->stride);
+    tcg_gen_ext_i32_ptr(cursor, off);
+    tcg_gen_addi_ptr(cursor, cursor, (intptr_t)trace->cursors->data);
+    tcg_temp_free_i32(off);
+}
+
+static void gen_mem_trace_check(struct qemu_plugin_mem_trace *trace, size_t n)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr cursor = tcg_temp_ebb_new_ptr();
+    TCGv_ptr pos = tcg_temp_ebb_new_ptr();
+    TCGv_ptr end = tcg_temp_ebb_new_ptr();
+    TCGLabel *skip = gen_new_label();
+
+    gen_mem_trace_cursor(cursor, cpu_index, trace);
+    tcg_gen_ld_ptr(pos, cursor,
+                   offsetof(struct qemu_plugin_mem_trace_cursor, pos));
+    tcg_gen_ld_ptr(end, cursor,
+                   offsetof(struct qemu_plugin_mem_trace_cursor, end));
+    tcg_gen_addi_ptr(pos, pos, n * sizeof(qemu_plugin_mem_record));
+    /* an unallocated buffer has pos == end == NULL and fails the test */
+    tcg_gen_brcond_ptr(TCG_COND_LEU, pos, end, skip);
+    gen_helper_plugin_mem_trace_flush(cpu_index, tcg_constant_ptr(trace));
+    gen_set_label(skip);
+
+    tcg_temp_free_ptr(end);
+    tcg_temp_free_ptr(pos);
+    tcg_temp_free_ptr(cursor);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void gen_mem_trace_record(const struct qemu_plugin_mem_trace *trace,
+                                 TCGv_i64 addr, uint32_t info)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr cursor = tcg_temp_ebb_new_ptr();
+    TCGv_ptr pos = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+
+    gen_mem_trace_cursor(cursor, cpu_index, trace);
+    tcg_gen_ld_ptr(pos, cursor,
+                   offsetof(struct qemu_plugin_mem_trace_cursor, pos));
+    tcg_gen_st_i64(addr, pos, offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_ld_i64(val, tcg_env, -offsetof(ArchCPU, env) +
+                                 offsetof(CPUState, plugin_mem_value_low));
+    tcg_gen_st_i64(val, pos, offsetof(qemu_plugin_mem_record, value));
+    tcg_gen_st_i32(tcg_constant_i32(info), pos,
+                   offsetof(qemu_plugin_mem_record, info));
+    tcg_gen_addi_ptr(pos, pos, sizeof(qemu_plugin_mem_record));
+    tcg_gen_st_ptr(pos, cursor,
+                   offsetof(struct qemu_plugin_mem_trace_cursor, pos));
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(pos);
+    tcg_temp_free_ptr(cursor);
+    tcg_temp_free_i32(cpu_index);
+}
+
+/* number of accesses of the instruction starting after @op that @cb traces */
+static size_t mem_trace_count(const struct qemu_plugin_dyn_cb *cb, TCGOp *op)
+{
+    size_t n = 0;
+
+    for (; op && op->opc != INDEX_op_insn_start; op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_plugin_cb_start &&
+            op->args[0] == PLUGIN_GEN_FROM_MEM &&
+            op->args[1] == PLUGIN_GEN_CB_MEM && op_rw(op, cb)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * A trace may be registered more than once for the same instruction, e.g.
+ * once for reads and once for writes, so the room checked for must cover
+ * the records of all its registrations at once.
+ */
+static void inject_mem_trace_check(const GArray *cbs, TCGOp *next_op)
+{
+    int i, j;
+
+    if (!cbs || cbs->len == 0) {
+        return;
+    }
+
+    tcg_ctx->emit_before_op = next_op;
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        struct qemu_plugin_mem_trace *trace = cb->userp;
+        size_t n = 0;
+
+        for (j = 0; j < i; j++) {
+            if (g_array_index(cbs, struct qemu_plugin_dyn_cb, j).userp ==
+                trace) {
+                break;
+            }
+        }
+        if (j < i) {
+            /* already checked for along with its first registration */
+            continue;
+        }
+        for (j = i; j < cbs->len; j++) {
+            struct qemu_plugin_dyn_cb *other =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+
+            if (other->userp == trace) {
+                n += mem_trace_count(other, next_op);
+            }
+        }
+        if (n) {
+            tcg_debug_assert(n <= trace->n_records);
+            gen_mem_trace_check(trace, n);
+        }
+    }
+    tcg_ctx->emit_before_op = NULL;
+}
+
+static void inject_mem_trace(const GArray *cbs, TCGOp *begin_op)
+{
+    TCGOp *op;
+    TCGTemp *ts;
+    TCGv_i64 addr;
+    uint32_t info;
+    int i;
+
+    if (!cbs || cbs->len == 0) {
+        return;
+    }
+
+    /* the callback template holds the meminfo and address of the access */
+    op = QTAILQ_NEXT(begin_op, link);
+    tcg_debug_assert(op->opc == INDEX_op_mov_i32);
+    info = arg_temp(op->args[1])->val;
+    op = find_op(op, INDEX_op_call);
+    ts = arg_temp(op->args[TCGOP_CALLO(op) + 2]);
+    tcg_debug_assert(ts->base_type == TCG_TYPE_I64);
+    addr = temp_tcgv_i64(ts - ts->temp_subindex);
+
+    tcg_ctx->emit_before_op = plugin_cb_next_op(begin_op);
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (op_rw(begin_op, cb)) {
+            gen_mem_trace_record(cb->userp, addr, info);
+        }
+    }
+    tcg_ctx->emit_before_op = NULL;
+}
+
 /* we could change the ops in place, but we can reuse more code by copying */
 static void inject_mem_helper(TCGOp *begin_op, GArray *arr)
 {
@@ -523,12 +864,13 @@ static void inject_mem_enable_helper(struct qemu_plugin_tb *ptb,
                                      struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -582,6 +924,91 @@ void plugin_gen_disable_mem_helpers(void)
                    offsetof(CPUState, plugin_mem_cbs) - offsetof(ArchCPU, env));
 }
 
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Conditional callbacks do not go through the empty-callback templates:
+ * they need a branch and a label, which the copy_op machinery cannot
+ * express. Instead the ops are generated directly, inserted in front of
+ * the op that follows the event's inline placeholder.
+ */
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    struct qemu_plugin_scoreboard *score = cb->cond.entry.score;
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_i32 off = tcg_temp_ebb_new_i32();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGLabel *skip = NULL;
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(off, cpu_index, score->stride);
+    tcg_gen_ext_i32_ptr(ptr, off);
+    tcg_gen_addi_ptr(ptr, ptr,
+                     (intptr_t)score->data + cb->cond.entry.offset);
+    tcg_gen_ld_i64(val, ptr, 0);
+    if (cb->cond.add) {
+        tcg_gen_addi_i64(val, val, cb->cond.add);
+        tcg_gen_st_i64(val, ptr, 0);
+    }
+
+    if (cb->cond.cond == QEMU_PLUGIN_COND_NEVER) {
+        goto out;
+    }
+    if (cb->cond.cond != QEMU_PLUGIN_COND_ALWAYS) {
+        TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+
+        skip = gen_new_label();
+        tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+    }
+
+    gen_udata_call(cb, cpu_index);
+
+    if (skip) {
+        gen_set_label(skip);
+    }
+ out:
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(off);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void inject_cond_cb(const GArray *cbs, TCGOp *next_op)
+{
+    int i;
+
+    if (!cbs || cbs->len == 0) {
+        return;
+    }
+
+    /* a NULL next_op means the event is last in the stream: just append */
+    tcg_ctx->emit_before_op = next_op;
+    for (i = 0; i < cbs->len; i++) {
+        gen_cond_cb(&g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
+    }
+    tcg_ctx->emit_before_op = NULL;
+}
+
 static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
                                 TCGOp *begin_op)
 {
@@ -591,7 +1018,10 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
+    TCGOp *next_op = plugin_cb_next_op(begin_op);
+
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], next_op);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -606,17 +1036,57 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    TCGOp *next_op = plugin_cb_next_op(begin_op);
+
     inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
                      begin_op, op_ok);
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], next_op);
+    inject_mem_trace_check(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE], next_op);
 }
 
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_mem_trace(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE], begin_op);
     inject_mem_cb(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR], begin_op);
 }
 
+static bool mem_value_used(const GArray *cbs, const TCGOp *begin_op)
+{
+    for (int i = 0; cbs && i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (op_rw(begin_op, cb)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void plugin_gen_mem_value(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    TCGOp *end_op;
+
+    if (!mem_value_used(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR],
+                        begin_op) &&
+        !mem_value_used(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE],
+                        begin_op)) {
+        rm_ops(begin_op);
+        return;
+    }
+
+    /* keep the stores, only drop the markers around them */
+    end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(end_op);
+    rm_ops_range(end_op, end_op);
+    rm_ops_range(begin_op, begin_op);
+}
+
 static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -679,6 +1149,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
+            case PLUGIN_GEN_CB_MEM_VALUE:
+                type = "mem value";
+                break;
             case PLUGIN_GEN_ENABLE_MEM_HELPER:
                 type = "enable mem helper";
                 break;
@@ -756,6 +1229,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_MEM:
                     plugin_gen_mem_regular(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_MEM_VALUE:
+                    plugin_gen_mem_value(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_mem_inline(plugin_tb, op, insn_idx);
                     break;
@@ -795,8 +1271,14 @@ bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
                          bool mem_only)
 {
     bool ret = false;
+    int mmu_idx = cpu_mmu_index(cpu_env(cpu), true);
 
-    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+    /*
+     * TBs no plugin wants get no placeholder, so that they run at the
+     * speed of uninstrumented code.
+     */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask) &&
+        qemu_plugin_tb_filter(db->pc_first, mmu_idx)) {
         struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
         int i;
 
@@ -815,6 +1297,7 @@ bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
         ptb->haddr1 = db->host_addr[0];
         ptb->haddr2 = NULL;
         ptb->mem_only = mem_only;
+        ptb->mmu_idx = mmu_idx;
         ptb->mem_helper = false;
 
         plugin_gen_empty_callback(PLUGIN_GEN_FROM_TB);
@@ -19,6 +19,8 @@
  */
 struct CPUJumpCache {
     struct rcu_head rcu;
+    /* next entry scanned for successors to translate speculatively */
+    unsigned speculate_pos;
     struct {
         TranslationBlock *tb;
         vaddr pc;
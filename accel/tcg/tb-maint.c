@@ -26,6 +26,7 @@
 #include "exec/tb-flush.h"
 #include "exec/translate-all.h"
 #include "sysemu/tcg.h"
+#include "exec/helper-proto-common.h"
 #include "tcg/tcg.h"
 #include "tb-hash.h"
 #include "tb-context.h"
@@ -50,16 +51,41 @@ static bool tb_cmp(const void *ap, const void *bp)
     return (a->pc == b->pc &&
             a->cs_base == b->cs_base &&
             a->flags == b->flags &&
-            (tb_cflags(a) & ~CF_INVALID) == (tb_cflags(b) & ~CF_INVALID) &&
+            (tb_key_cflags(a) & ~CF_INVALID) ==
+            (tb_key_cflags(b) & ~CF_INVALID) &&
             tb_page_addr0(a) == tb_page_addr0(b) &&
             tb_page_addr1(a) == tb_page_addr1(b));
 }
 
+/*
+ * Physical PCs of the blocks promoted to tier 2 since the last flush.
+ * The next translation at one of these addresses is done with CF_TIER2.
+ */
+static struct {
+    QemuMutex lock;
+    GHashTable *hot;
+} tb_tier;
+
 void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+
+    qemu_mutex_init(&tb_tier.lock);
+    tb_tier.hot = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                        g_free, NULL);
+}
+
+bool tb_tier_is_hot(tb_page_addr_t phys_pc)
+{
+    uint64_t key = phys_pc;
+    bool hot;
+
+    qemu_mutex_lock(&tb_tier.lock);
+    hot = g_hash_table_contains(tb_tier.hot, &key);
+    qemu_mutex_unlock(&tb_tier.lock);
+    return hot;
 }
 
 typedef struct PageDesc PageDesc;
@@ -766,10 +792,18 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     }
     did_flush = true;
 
+#ifndef CONFIG_USER_ONLY
+    tb_profile_requeue();
+#endif
+
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
     }
 
+    qemu_mutex_lock(&tb_tier.lock);
+    g_hash_table_remove_all(tb_tier.hot);
+    qemu_mutex_unlock(&tb_tier.lock);
+
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     tb_remove_all();
 
@@ -917,7 +951,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     /* remove the TB from the hash list */
     phys_pc = tb_page_addr0(tb);
     h = tb_hash_func(phys_pc, tb->pc,
-                     tb->flags, tb->cs_base, orig_cflags);
+                     tb->flags, tb->cs_base, orig_cflags & ~CF_TIER2);
     if (!qht_remove(&tb_ctx.htable, tb, h)) {
         return;
     }
@@ -963,6 +997,31 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+/*
+ * Called from a tier 1 TB once it has run tb_tier_threshold times.
+ * Invalidate it so that the next lookup translates its code again,
+ * this time with CF_TIER2.
+ */
+void HELPER(tb_promote)(void *ptr)
+{
+    TranslationBlock *tb = ptr;
+    uint64_t phys_pc = tb_page_addr0(tb);
+
+    if (tb_cflags(tb) & CF_INVALID) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_tier.lock);
+    g_hash_table_add(tb_tier.hot, g_memdup2(&phys_pc, sizeof(phys_pc)));
+    qemu_mutex_unlock(&tb_tier.lock);
+
+    mmap_lock();
+    qemu_thread_jit_write();
+    tb_phys_invalidate(tb, -1);
+    qemu_thread_jit_execute();
+    mmap_unlock();
+}
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -984,7 +1043,7 @@ TranslationBlock *tb_link_page(TranslationBlock *tb)
 
     /* add in the hash table */
     h = tb_hash_func(tb_page_addr0(tb), tb->pc,
-                     tb->flags, tb->cs_base, tb->cflags);
+                     tb->flags, tb->cs_base, tb_key_cflags(tb));
     qht_insert(&tb_ctx.htable, tb, h, &existing_tb);
 
     /* remove TB from the page(s) if we couldn't insert it */
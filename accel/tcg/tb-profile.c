@@ -0,0 +1,292 @@
+/*
+ * Translation cache pre-warming
+ *
+ * With -accel tcg,tb-profile=FILE the key of every translation block
+ * still live at exit is written to FILE: virtual PC, cs_base, flags,
+ * cflags, the RAM addresses of its pages and a checksum of its guest
+ * code. When the next run starts, each vCPU entering the execution loop
+ * takes a few entries from the profile and translates those the guest
+ * can still reach: the PC must map to the same RAM pages and the code
+ * there must be unchanged. This moves the translation of a restored
+ * guest's working set ahead of its execution and spreads it across the
+ * vCPUs, which helps most when starting with -loadvm.
+ *
+ * With tb-profile or tb-speculate=on the same queue also carries the
+ * working set across a flush of the translation cache, see
+ * tb_profile_requeue().
+ *
+ * Host code is not saved, only the keys: generated code embeds the host
+ * addresses of helpers, plugin callbacks and their data, which differ
+ * from one run to the next. Every block of the profile is therefore
+ * translated again, so this is not a persistent translation cache: the
+ * startup translation work is the same, it is only done before the guest
+ * asks for the blocks rather than when it first runs them.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "qemu/rcu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "sysemu/sysemu.h"
+#include "tb-context.h"
+#include "tb-jmp-cache.h"
+#include "internal-common.h"
+#include "internal-target.h"
+
+#define TB_PROFILE_MAGIC "QEMUTBP"
+
+typedef struct TBProfileHeader {
+    char magic[8];
+    char target[16];
+    char version[32];
+    uint32_t page_bits;
+    uint32_t n_entries;
+} TBProfileHeader;
+
+typedef struct TBProfileEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t page_addr0;
+    uint64_t page_addr1;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t crc;
+} TBProfileEntry;
+
+static struct {
+    char *path;
+    Notifier exit_notifier;
+    TBProfileEntry *entries;
+    uint32_t n_entries;
+    /* index of the next entry to replay, shared by the vCPUs */
+    uint32_t next;
+    /* the entries are only valid until the next flush */
+    unsigned flush_count;
+    /* entries may fill the TLB, i.e. they come from the profile file */
+    bool walk;
+} tb_profile;
+
+bool tb_profile_pending;
+
+/* cflags of blocks that are only ever generated on demand */
+#define TB_PROFILE_CF_SKIP \
+    (CF_COUNT_MASK | CF_INVALID | CF_NOIRQ | CF_SINGLE_STEP | CF_MEMI_ONLY)
+
+static uint32_t tb_profile_crc(const void *host0, const void *host1,
+                               vaddr offset, uint32_t size)
+{
+    uint32_t len0 = MIN(size, TARGET_PAGE_SIZE -
+                              (offset & ~TARGET_PAGE_MASK));
+    uint32_t crc = crc32c(0xffffffff, host0, len0);
+
+    if (len0 < size) {
+        crc = crc32c(crc, host1, size - len0);
+    }
+    return crc;
+}
+
+static void tb_profile_record(void *p, uint32_t hash, void *userp)
+{
+    const TranslationBlock *tb = p;
+    GArray *entries = userp;
+    tb_page_addr_t page_addr0 = tb_page_addr0(tb);
+    tb_page_addr_t page_addr1 = tb_page_addr1(tb);
+    void *host1 = NULL;
+    TBProfileEntry e;
+
+    if (tb_cflags(tb) & TB_PROFILE_CF_SKIP || page_addr0 == -1) {
+        return;
+    }
+    if (page_addr1 != -1) {
+        host1 = qemu_map_ram_ptr(NULL, page_addr1);
+    }
+
+    e.pc = tb->pc;
+    e.cs_base = tb->cs_base;
+    e.page_addr0 = page_addr0;
+    e.page_addr1 = page_addr1;
+    e.flags = tb->flags;
+    e.cflags = tb_key_cflags(tb);
+    e.size = tb->size;
+    e.crc = tb_profile_crc(qemu_map_ram_ptr(NULL, page_addr0), host1,
+                           page_addr0, tb->size);
+    g_array_append_val(entries, e);
+}
+
+static void tb_profile_save(Notifier *n, void *data)
+{
+    g_autoptr(GArray) entries = g_array_new(false, false,
+                                            sizeof(TBProfileEntry));
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    g_autoptr(GError) err = NULL;
+    TBProfileHeader hdr = { 0 };
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        qht_iter(&tb_ctx.htable, tb_profile_record, entries);
+    }
+
+    strncpy(hdr.magic, TB_PROFILE_MAGIC, sizeof(hdr.magic));
+    strncpy(hdr.target, TARGET_NAME, sizeof(hdr.target));
+    strncpy(hdr.version, QEMU_VERSION, sizeof(hdr.version));
+    hdr.page_bits = TARGET_PAGE_BITS;
+    hdr.n_entries = entries->len;
+
+    g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(buf, (guint8 *)entries->data,
+                        entries->len * sizeof(TBProfileEntry));
+    if (!g_file_set_contents(tb_profile.path, (gchar *)buf->data, buf->len,
+                             &err)) {
+        warn_report("tb-profile: cannot save %s: %s", tb_profile.path,
+                    err->message);
+    }
+}
+
+static void tb_profile_load(void)
+{
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *contents = NULL;
+    TBProfileHeader hdr;
+    gsize len;
+
+    if (!g_file_get_contents(tb_profile.path, &contents, &len, &err)) {
+        /* nothing recorded yet, the profile is created at exit */
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            warn_report("tb-profile: cannot read %s: %s", tb_profile.path,
+                        err->message);
+        }
+        return;
+    }
+    if (len < sizeof(hdr)) {
+        goto bad;
+    }
+    memcpy(&hdr, contents, sizeof(hdr));
+    if (strncmp(hdr.magic, TB_PROFILE_MAGIC, sizeof(hdr.magic)) ||
+        len != sizeof(hdr) + (gsize)hdr.n_entries * sizeof(TBProfileEntry)) {
+        goto bad;
+    }
+    /* block flags are only meaningful to the QEMU that recorded them */
+    if (strncmp(hdr.target, TARGET_NAME, sizeof(hdr.target)) ||
+        strncmp(hdr.version, QEMU_VERSION, sizeof(hdr.version)) ||
+        hdr.page_bits != TARGET_PAGE_BITS) {
+        warn_report("tb-profile: %s was recorded by another QEMU, ignoring it",
+                    tb_profile.path);
+        return;
+    }
+
+    tb_profile.n_entries = hdr.n_entries;
+    tb_profile.entries = g_memdup2(contents + sizeof(hdr),
+                                   len - sizeof(hdr));
+    tb_profile.flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+    tb_profile.walk = true;
+    qatomic_set(&tb_profile_pending, tb_profile.n_entries > 0);
+    return;
+
+ bad:
+    warn_report("tb-profile: %s is not a translation profile, ignoring it",
+                tb_profile.path);
+}
+
+void tb_profile_init(const char *path)
+{
+    tb_profile.path = g_strdup(path);
+    tb_profile_load();
+
+    tb_profile.exit_notifier.notify = tb_profile_save;
+    qemu_add_exit_notifier(&tb_profile.exit_notifier);
+}
+
+/*
+ * Called before flushing the translation cache, in an exclusive section.
+ * Replace whatever is left of the queue with the blocks in the vCPUs'
+ * jump caches, i.e. the ones they ran most recently, so that they are
+ * translated again once the flush is done, like a profile loaded at
+ * startup.
+ */
+void tb_profile_requeue(void)
+{
+    GArray *entries;
+    CPUState *cpu;
+
+    if (!tb_profile.path && !tb_speculate) {
+        return;
+    }
+
+    entries = g_array_new(false, false, sizeof(TBProfileEntry));
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+            for (int i = 0; jc && i < TB_JMP_CACHE_SIZE; i++) {
+                TranslationBlock *tb = qatomic_read(&jc->array[i].tb);
+
+                if (tb) {
+                    tb_profile_record(tb, 0, entries);
+                }
+            }
+        }
+    }
+
+    g_free(tb_profile.entries);
+    tb_profile.n_entries = entries->len;
+    tb_profile.entries = (TBProfileEntry *)g_array_free(entries, false);
+    tb_profile.next = 0;
+    /* valid once the flush in progress has completed */
+    tb_profile.flush_count = tb_ctx.tb_flush_count + 1;
+    /* the working set is speculative, it must not touch page tables */
+    tb_profile.walk = false;
+    qatomic_set(&tb_profile_pending, tb_profile.n_entries > 0);
+}
+
+/* Check that @e describes code that @cpu reaches at e->pc right now. */
+static bool tb_profile_entry_valid(CPUState *cpu, const TBProfileEntry *e)
+{
+    CPUArchState *env = cpu_env(cpu);
+    void *host0, *host1 = NULL;
+    tb_page_addr_t (*probe)(CPUArchState *, vaddr, void **) =
+        tb_profile.walk ? get_page_addr_code_nofault : get_page_addr_code_tlb;
+
+    if (e->cflags != curr_cflags(cpu)) {
+        return false;
+    }
+    if (probe(env, e->pc, &host0) != e->page_addr0) {
+        return false;
+    }
+    if (e->page_addr1 != -1 &&
+        probe(env, TARGET_PAGE_ALIGN(e->pc), &host1) != e->page_addr1) {
+        return false;
+    }
+    return tb_profile_crc(host0, host1, e->pc, e->size) == e->crc;
+}
+
+bool tb_profile_next(CPUState *cpu, vaddr *pc, uint64_t *cs_base,
+                     uint32_t *flags, uint32_t *cflags)
+{
+    for (;;) {
+        const TBProfileEntry *e;
+        uint32_t i = tb_profile.n_entries;
+
+        if (qatomic_read(&tb_profile.next) < tb_profile.n_entries) {
+            i = qatomic_fetch_inc(&tb_profile.next);
+        }
+        if (i >= tb_profile.n_entries ||
+            qatomic_read(&tb_ctx.tb_flush_count) != tb_profile.flush_count) {
+            qatomic_set(&tb_profile_pending, false);
+            return false;
+        }
+        e = &tb_profile.entries[i];
+        if (tb_profile_entry_valid(cpu, e)) {
+            *pc = e->pc;
+            *cs_base = e->cs_base;
+            *flags = e->flags;
+            *cflags = e->cflags;
+            return true;
+        }
+    }
+}
@@ -47,6 +47,9 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    char *tb_profile;
+    bool tb_speculate;
+    uint32_t tier_threshold;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +102,8 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+bool tb_speculate;
+uint32_t tb_tier_threshold;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,10 +116,27 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_speculate = s->tb_speculate;
+    /*
+     * What gets translated ahead, and when the code buffer fills up,
+     * depends on host timing, which must not leak into the guest.
+     */
+    if (tb_speculate &&
+        (icount_enabled() || replay_mode != REPLAY_MODE_NONE)) {
+        warn_report("tb-speculate=on is ignored with icount or "
+                    "record/replay");
+        tb_speculate = false;
+    }
+    tb_tier_threshold = s->tier_threshold;
 
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+#ifndef CONFIG_USER_ONLY
+    if (s->tb_profile) {
+        tb_profile_init(s->tb_profile);
+    }
+#endif
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -181,6 +203,63 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifndef CONFIG_USER_ONLY
+static char *tcg_get_tb_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_profile);
+}
+
+static void tcg_set_tb_profile(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_profile);
+    s->tb_profile = g_strdup(value);
+}
+
+static bool tcg_get_tb_speculate(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_speculate;
+}
+
+static void tcg_set_tb_speculate(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_speculate = value;
+}
+#endif
+
+#ifdef TARGET_SUPPORTS_TB_TIER2
+static void tcg_get_tier_threshold(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tier_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tier_threshold(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->tier_threshold = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -242,6 +321,30 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add_str(oc, "tb-profile",
+                                  tcg_get_tb_profile,
+                                  tcg_set_tb_profile);
+    object_class_property_set_description(oc, "tb-profile",
+        "Profile to pre-warm the translation cache from at startup and "
+        "record to at exit");
+
+    object_class_property_add_bool(oc, "tb-speculate",
+                                   tcg_get_tb_speculate,
+                                   tcg_set_tb_speculate);
+    object_class_property_set_description(oc, "tb-speculate",
+        "Translate likely successors of recent blocks on idle vCPUs");
+#endif
+
+#ifdef TARGET_SUPPORTS_TB_TIER2
+    object_class_property_add(oc, "tier-threshold", "int",
+        tcg_get_tier_threshold, tcg_set_tier_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tier-threshold",
+        "Executions after which a block is retranslated as a superblock "
+        "(0 to disable)");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
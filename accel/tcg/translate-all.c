@@ -305,6 +305,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | 1;
+    } else if (tb_tier_threshold && !(cflags & TB_TIER_CF_SKIP) &&
+               tb_tier_is_hot(phys_pc)) {
+        cflags |= CF_TIER2;
     }
 
     max_insns = cflags & CF_COUNT_MASK;
@@ -331,6 +334,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->exec_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -353,6 +357,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
  restart_translate:
     trace_translate_block(tb, pc, tb->tc.ptr);
+    tb->succ_pc[0] = -1;
+    tb->succ_pc[1] = -1;
 
     gen_code_size = setjmp_gen_code(env, tb, pc, host_pc, &max_insns, &ti);
     if (unlikely(gen_code_size < 0)) {
@@ -13,6 +13,7 @@
 #include "exec/exec-all.h"
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
+#include "exec/helper-gen-common.h"
 #include "tcg/tcg-op-common.h"
 #include "internal-target.h"
 
@@ -42,6 +43,29 @@ bool translator_io_start(DisasContextBase *db)
     return true;
 }
 
+/*
+ * Count the executions of a tier 1 TB; the one that reaches
+ * tb_tier_threshold promotes it to tier 2.
+ *
+ * The increment is not atomic, so vCPUs running the same TB under MTTCG
+ * can lose counts, or both see the threshold: the count is only a hint,
+ * promotion may come a little late, and HELPER(tb_promote) ignores a TB
+ * it has already invalidated.
+ */
+static void gen_tb_count(const TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(tb);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *skip = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, offsetof(TranslationBlock, exec_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, tb_tier_threshold, skip);
+    gen_helper_tb_promote(ptr);
+    gen_set_label(skip);
+}
+
 static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
 {
     TCGv_i32 count = NULL;
@@ -84,6 +108,11 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
                          - offsetof(ArchCPU, env));
     }
 
+    if (tb_tier_threshold && tb_page_addr0(db->tb) != -1 &&
+        !(cflags & (TB_TIER_CF_SKIP | CF_TIER2))) {
+        gen_tb_count(db->tb);
+    }
+
     /*
      * cpu->neg.can_do_io is set automatically here at the beginning of
      * each translation block.  The cost is minimal, plus it would be
@@ -120,7 +149,17 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if (((db->pc_first ^ dest) & TARGET_PAGE_MASK) != 0) {
+        return false;
+    }
+
+    /* Remember the successor for speculative translation. */
+    if (db->tb->succ_pc[0] == (vaddr)-1 || db->tb->succ_pc[0] == dest) {
+        db->tb->succ_pc[0] = dest;
+    } else if (db->tb->succ_pc[1] == (vaddr)-1) {
+        db->tb->succ_pc[1] = dest;
+    }
+    return true;
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
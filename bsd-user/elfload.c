@@ -497,6 +497,7 @@ found:
     s->disas_symtab.elf64 = syms;
     s->lookup_symbol = (lookup_symbol_t)lookup_symbolxx;
 #endif
+    s->lookup_name = NULL;
     s->next = syminfos;
     syminfos = s;
 }
@@ -1,5 +1,6 @@
 TARGET_ARCH=riscv32
 TARGET_BASE_ARCH=riscv
+TARGET_SUPPORTS_TB_TIER2=y
 TARGET_ABI_DIR=riscv
 TARGET_XML_FILES= gdb-xml/riscv-32bit-cpu.xml gdb-xml/riscv-32bit-fpu.xml gdb-xml/riscv-64bit-fpu.xml gdb-xml/riscv-32bit-virtual.xml
 CONFIG_SEMIHOSTING=y
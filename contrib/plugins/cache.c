@@ -5,25 +5,39 @@
  *   See the COPYING file in the top-level directory.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 
 #include <qemu-plugin.h>
 
+#include "cache.h"
+
 #define STRTOLL(x) g_ascii_strtoll(x, NULL, 10)
 
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
-static GHashTable *miss_ht;
-
-static GMutex hashtable_lock;
+/*
+ * Per-instruction statistics, keyed by address. Each translating thread
+ * fills its own table so that retranslation after a flush does not
+ * serialise all vCPUs on a lock; the tables are merged at exit.
+ */
+static __thread GHashTable *miss_ht;
+static GSList *miss_tables;
+static GMutex miss_tables_lock;
 static GRand *rng;
+/* Only used from the monitor, i.e. with the BQL held */
+static GRand *sample_rng;
 
 static int limit;
 static bool sys;
+static bool save_vmstate;
+static bool async_sim;
 
 enum EvictionPolicy {
     LRU,
@@ -54,11 +68,18 @@ enum EvictionPolicy policy;
  * match is found, then the access is a hit.
  *
  * The CacheSet also contains bookkeaping information about eviction details.
+ *
+ * Each Cache additionally keeps the list of its valid blocks, as indices into
+ * a flattened sets * assoc array, so that a resident line can be picked
+ * uniformly at random in constant time. It is protected by the same lock as
+ * the rest of the cache.
  */
 
 typedef struct {
     uint64_t tag;
     bool valid;
+    /* filled by a prefetch and not referenced by a demand access since */
+    bool prefetched;
 } CacheBlock;
 
 typedef struct {
@@ -66,8 +87,22 @@ typedef struct {
     uint64_t *lru_priorities;
     uint64_t lru_gen_counter;
     GQueue *fifo_queue;
+    /* last demand block evicted by a prefetch, to detect pollution */
+    uint64_t pf_victim;
+    bool pf_victim_valid;
 } CacheSet;
 
+/*
+ * Prefetch statistics. @misses counts every demand miss, including the
+ * ones outside of sampling windows, so that coverage can be derived.
+ */
+typedef struct {
+    uint64_t issued;
+    uint64_t useful;
+    uint64_t polluting;
+    uint64_t misses;
+} PrefetchStats;
+
 typedef struct {
     CacheSet *sets;
     int num_sets;
@@ -78,17 +113,32 @@ typedef struct {
     uint64_t tag_mask;
     uint64_t accesses;
     uint64_t misses;
+    uint32_t *resident;
+    uint32_t n_resident;
+    PrefetchStats pf;
 } Cache;
 
 typedef struct {
     char *disas_str;
     const char *symbol;
     uint64_t addr;
+    /* InsnAlias of each vaddr the instruction was translated at */
+    GHashTable *aliases;
     uint64_t l1_dmisses;
     uint64_t l1_imisses;
     uint64_t l2_misses;
 } InsnData;
 
+/*
+ * The same physical instruction may be mapped at several vaddrs, so the
+ * execution callback of each translation gets the vaddr it was translated
+ * at along with the shared statistics.
+ */
+typedef struct {
+    InsnData *insn;
+    uint64_t vaddr;
+} InsnAlias;
+
 void (*update_hit)(Cache *cache, int set, int blk);
 void (*update_miss)(Cache *cache, int set, int blk);
 
@@ -118,6 +168,121 @@ int l1_iassoc, l1_iblksize, l1_icachesize;
 int l1_dassoc, l1_dblksize, l1_dcachesize;
 int l2_assoc, l2_blksize, l2_cachesize;
 
+/*
+ * Hardware prefetchers, configured per cache level. They are trained on
+ * the demand accesses of a level while its lock is held, and fill the
+ * lines they predict into that same level.
+ *
+ * Training state is kept per core, like the caches it fills, so that
+ * each vCPU trains its own prefetchers as on hardware, whichever host
+ * thread simulates its accesses. It is protected by the lock of the level.
+ */
+typedef enum {
+    PF_NONE,
+    PF_NEXTLINE,
+    PF_STRIDE,
+    PF_STREAM,
+} PrefetchKind;
+
+#define PF_MAX_DEGREE 8
+#define PF_STRIDE_ENTRIES 64
+#define PF_STREAMS 8
+
+/* Reference prediction table entry, indexed by the PC of the access */
+typedef struct {
+    uint64_t pc;
+    uint64_t last_addr;
+    int64_t stride;
+    int conf;
+} StrideEntry;
+
+typedef struct {
+    uint64_t last_blk;
+    uint64_t lru;
+    int dir;
+    int conf;
+} StreamTracker;
+
+typedef struct {
+    StrideEntry stride[PF_STRIDE_ENTRIES];
+    StreamTracker streams[PF_STREAMS];
+    uint64_t clock;
+} Prefetcher;
+
+static PrefetchKind l1_dprefetch, l1_iprefetch, l2_prefetch;
+static int prefetch_degree = 1;
+
+static Prefetcher *l1_dpf, *l1_ipf, *l2_pf;
+
+/* Outcome of the last access simulated on this vCPU thread */
+static __thread CacheAccessOutcome last_outcome;
+static cache_access_hook_fn access_hook;
+
+/*
+ * Sampled simulation, in the style of SMARTS: every sample_period
+ * instructions executed by a vCPU thread, only the last sample_window are
+ * simulated in detail. The others only update the tags (functional
+ * warming), so the caches are warm when a window starts but no statistics
+ * or per-instruction misses are recorded for them.
+ *
+ * Each window yields one miss rate sample per cache level, from which the
+ * report derives the mean and its confidence interval.
+ */
+enum {
+    SAMPLE_L1D,
+    SAMPLE_L1I,
+    SAMPLE_L2,
+    SAMPLE_LEVELS,
+};
+
+typedef struct {
+    uint64_t insns;
+    uint64_t accesses[SAMPLE_LEVELS];
+    uint64_t misses[SAMPLE_LEVELS];
+} SampleWindow;
+
+typedef struct {
+    uint64_t n;
+    double sum;
+    double sum_sq;
+} SampleStat;
+
+static uint64_t sample_period;
+static uint64_t sample_window;
+static GMutex sample_lock;
+static SampleStat sample_stats[SAMPLE_LEVELS];
+/* windows of all threads, so that the partial ones are counted at exit */
+static GSList *sample_windows;
+
+static __thread uint64_t sample_pos;
+static __thread bool sample_detailed;
+static __thread SampleWindow *cur_window;
+
+/*
+ * Miss ratio curve of the data stream of each core, computed in a single
+ * pass from LRU stack (reuse) distances as in SHARDS: a block is tracked
+ * only if the hash of its address falls below mrc_rate, and the distances
+ * measured among the tracked blocks are scaled by 1 / mrc_rate. Memory use
+ * is proportional to the number of tracked blocks.
+ *
+ * The stack is a GSequence in last-access order, so the distance of a
+ * block is the number of entries after its previous position.
+ */
+typedef struct {
+    GMutex lock;
+    GHashTable *last_access;
+    GSequence *stack;
+    GArray *hist;
+    uint64_t cold;
+    uint64_t total;
+} MrcState;
+
+#define MRC_HASH_RANGE (1ULL << 24)
+
+static double mrc_rate;
+static uint64_t mrc_threshold;
+static MrcState *mrc_states;
+
 static int pow_of_two(int num)
 {
     g_assert((num & (num - 1)) == 0);
@@ -128,23 +293,6 @@ static int pow_of_two(int num)
     return ret;
 }
 
-static size_t *random_indices(size_t max, size_t num_indices)
-{
-    size_t step = max / num_indices;
-    size_t* ret = malloc(num_indices * sizeof(size_t));
-
-    for (size_t i = 0; i < num_indices; i++)
-        ret[i] = i * step;
-
-    for (size_t i = 0; i < num_indices; i++) {
-        size_t j = i + rand() / (RAND_MAX / (num_indices - i) + 1);
-        size_t temp = ret[j];
-        ret[j] = ret[i];
-        ret[i] = temp;
-    }
-    return ret;
-}
-
 /*
  * LRU evection policy: For each set, a generation counter is maintained
  * alongside a priority array.
@@ -280,14 +428,16 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
      */
     g_assert(!bad_cache_params(blksize, assoc, cachesize));
 
-    cache = g_new(Cache, 1);
+    cache = g_new0(Cache, 1);
     cache->assoc = assoc;
     cache->cachesize = cachesize;
     cache->num_sets = cachesize / (blksize * assoc);
-    cache->sets = g_new(CacheSet, cache->num_sets);
+    cache->sets = g_new0(CacheSet, cache->num_sets);
     cache->blksize_shift = pow_of_two(blksize);
     cache->accesses = 0;
     cache->misses = 0;
+    cache->resident = g_new(uint32_t, cache->num_sets * assoc);
+    cache->n_resident = 0;
 
     for (i = 0; i < cache->num_sets; i++) {
         cache->sets[i].blocks = g_new0(CacheBlock, assoc);
@@ -322,23 +472,6 @@ static Cache **caches_init(int blksize, int assoc, int cachesize)
     return caches;
 }
 
-static int get_valid_block(Cache *cache, uint64_t set)
-{
-    int i;
-    size_t* cache_order = random_indices(cache->assoc, cache->assoc);
-
-    for (i = 0; i < cache->assoc; i++) {
-        if (cache->sets[set].blocks[cache_order[i]].valid) {
-            int ret = cache_order[i];
-            free(cache_order);
-            return ret;
-        }
-    }
-
-    free(cache_order);
-    return -1;
-}
-
 static int get_invalid_block(Cache *cache, uint64_t set)
 {
     int i;
@@ -384,15 +517,72 @@ static int in_cache(Cache *cache, uint64_t addr)
     return -1;
 }
 
+static void resident_add(Cache *cache, int set, int blk)
+{
+    cache->resident[cache->n_resident++] = set * cache->assoc + blk;
+}
+
+/*
+ * Return in @addr the address of the @r-th resident line, or false if
+ * there are not that many. Must be called with the cache lock held.
+ */
+static bool resident_sample(Cache *cache, uint32_t r, uint64_t *addr)
+{
+    uint32_t idx;
+    int set, blk;
+
+    if (r >= cache->n_resident) {
+        return false;
+    }
+
+    idx = cache->resident[r];
+    set = idx / cache->assoc;
+    blk = idx % cache->assoc;
+    *addr = cache->sets[set].blocks[blk].tag |
+            ((uint64_t)set << cache->blksize_shift);
+    return true;
+}
+
+/*
+ * Put the line of @tag into @set, evicting a block if needed, and return
+ * the way it was put in. A prefetch evicting a demand-fetched line records
+ * it so that a later miss on it is counted as pollution.
+ */
+static int cache_fill(Cache *cache, uint64_t set, uint64_t tag, bool prefetch)
+{
+    CacheSet *s = &cache->sets[set];
+    int blk = get_invalid_block(cache, set);
+
+    if (blk == -1) {
+        blk = get_replaced_block(cache, set);
+        if (prefetch && !s->blocks[blk].prefetched) {
+            s->pf_victim = s->blocks[blk].tag;
+            s->pf_victim_valid = true;
+        }
+    } else {
+        resident_add(cache, set, blk);
+    }
+
+    if (update_miss) {
+        update_miss(cache, set, blk);
+    }
+
+    s->blocks[blk].tag = tag;
+    s->blocks[blk].valid = true;
+    s->blocks[blk].prefetched = prefetch;
+    return blk;
+}
+
 /**
  * access_cache(): Simulate a cache access
  * @cache: The cache under simulation
  * @addr: The address of the requested memory location
+ * @blk: Set to the block that holds the requested data after the access
  *
  * Returns true if the requested data is hit in the cache and false when missed.
  * The cache is updated on miss for the next access.
  */
-static bool access_cache(Cache *cache, uint64_t addr)
+static bool access_cache(Cache *cache, uint64_t addr, int *blk)
 {
     int hit_blk, replaced_blk;
     uint64_t tag, set;
@@ -405,237 +595,860 @@ static bool access_cache(Cache *cache, uint64_t addr)
         if (update_hit) {
             update_hit(cache, set, hit_blk);
         }
+        if (cache->sets[set].blocks[hit_blk].prefetched) {
+            cache->sets[set].blocks[hit_blk].prefetched = false;
+            cache->pf.useful++;
+        }
+        *blk = hit_blk;
         return true;
     }
 
-    replaced_blk = get_invalid_block(cache, set);
-
-    if (replaced_blk == -1) {
-        replaced_blk = get_replaced_block(cache, set);
-    }
-
-    if (update_miss) {
-        update_miss(cache, set, replaced_blk);
+    cache->pf.misses++;
+    if (cache->sets[set].pf_victim_valid &&
+        cache->sets[set].pf_victim == tag) {
+        cache->sets[set].pf_victim_valid = false;
+        cache->pf.polluting++;
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    replaced_blk = cache_fill(cache, set, tag, false);
+    *blk = replaced_blk;
 
     return false;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+/* Fill the line of @addr in @cache on behalf of a prefetcher */
+static void prefetch_fill(Cache *cache, uint64_t addr)
 {
-    uint64_t effective_addr;
-    struct qemu_plugin_hwaddr *hwaddr;
-    int cache_idx;
-    InsnData *insn;
-    bool hit_in_l1;
-
-    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+    if (in_cache(cache, addr) != -1) {
         return;
     }
 
-    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
-    cache_idx = vcpu_index % cores;
-
-    if (effective_addr > max_effective_addr)
-        max_effective_addr = effective_addr;
+    cache_fill(cache, extract_set(cache, addr), extract_tag(cache, addr), true);
+    cache->pf.issued++;
+}
 
-    g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
+static int stride_predict(Prefetcher *pf, uint64_t pc, uint64_t addr,
+                          uint64_t *out)
+{
+    StrideEntry *e = &pf->stride[(pc >> 1) % PF_STRIDE_ENTRIES];
+    int64_t stride;
+    int n = 0;
+
+    if (e->pc != pc) {
+        e->pc = pc;
+        e->last_addr = addr;
+        e->stride = 0;
+        e->conf = 0;
+        return 0;
     }
-    l1_dcaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
 
-    if (hit_in_l1 || !use_l2) {
-        /* No need to access L2 */
-        return;
+    stride = addr - e->last_addr;
+    if (stride && stride == e->stride) {
+        e->conf = MIN(e->conf + 1, 3);
+    } else if (e->conf) {
+        e->conf--;
+    } else {
+        e->stride = stride;
     }
+    e->last_addr = addr;
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+    if (e->conf >= 2) {
+        for (n = 0; n < prefetch_degree; n++) {
+            out[n] = addr + e->stride * (n + 1);
+        }
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    return n;
 }
 
-static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+/*
+ * Streams are detected on misses: a miss within a few lines of the head
+ * of a tracked stream extends it, and once it has moved twice in the same
+ * direction the next lines ahead of the head are prefetched.
+ */
+static int stream_predict(Prefetcher *pf, uint64_t blk, int shift,
+                          uint64_t *out)
 {
-    uint64_t insn_addr;
-    InsnData *insn;
-    int cache_idx;
-    bool hit_in_l1;
+    StreamTracker *t, *victim = &pf->streams[0];
+    int64_t delta;
+    int dir, n = 0;
+
+    for (int i = 0; i < PF_STREAMS; i++) {
+        t = &pf->streams[i];
+        delta = blk - t->last_blk;
+        if (t->lru && delta && delta >= -4 && delta <= 4) {
+            dir = delta > 0 ? 1 : -1;
+            t->conf = dir == t->dir ? MIN(t->conf + 1, 3) : 0;
+            t->dir = dir;
+            t->last_blk = blk;
+            t->lru = ++pf->clock;
+            if (t->conf >= 1) {
+                for (n = 0; n < prefetch_degree; n++) {
+                    out[n] = (blk + (int64_t)dir * (n + 1)) << shift;
+                }
+            }
+            return n;
+        }
+        if (t->lru < victim->lru) {
+            victim = t;
+        }
+    }
 
-    insn_addr = ((InsnData *) userdata)->addr;
+    victim->last_blk = blk;
+    victim->dir = 0;
+    victim->conf = 0;
+    victim->lru = ++pf->clock;
+    return 0;
+}
 
-    cache_idx = vcpu_index % cores;
-    g_mutex_lock(&l1_icache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
-        l1_icaches[cache_idx]->misses++;
-    }
-    l1_icaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+/*
+ * Train the prefetcher of a level with a demand access and fill the lines
+ * it predicts. Called with the lock of @cache held.
+ */
+static void prefetch(PrefetchKind kind, Prefetcher *pf, Cache *cache,
+                     uint64_t pc, uint64_t addr, bool hit)
+{
+    uint64_t out[PF_MAX_DEGREE];
+    uint64_t blk = addr >> cache->blksize_shift;
+    int n = 0;
 
-    if (hit_in_l1 || !use_l2) {
-        /* No need to access L2 */
+    switch (kind) {
+    case PF_NONE:
         return;
+    case PF_NEXTLINE:
+        if (!hit) {
+            for (n = 0; n < prefetch_degree; n++) {
+                out[n] = (blk + n + 1) << cache->blksize_shift;
+            }
+        }
+        break;
+    case PF_STRIDE:
+        n = stride_predict(pf, pc, addr, out);
+        break;
+    case PF_STREAM:
+        if (!hit) {
+            n = stream_predict(pf, blk, cache->blksize_shift, out);
+        }
+        break;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+    for (int i = 0; i < n; i++) {
+        prefetch_fill(cache, out[i]);
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
-static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+static SampleWindow *get_window(void)
 {
-    size_t n_insns;
-    size_t i;
-    InsnData *data;
-
-    n_insns = qemu_plugin_tb_n_insns(tb);
-    for (i = 0; i < n_insns; i++) {
-        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-        uint64_t effective_addr;
+    if (G_UNLIKELY(!cur_window)) {
+        cur_window = g_new0(SampleWindow, 1);
+        g_mutex_lock(&sample_lock);
+        sample_windows = g_slist_prepend(sample_windows, cur_window);
+        g_mutex_unlock(&sample_lock);
+    }
+    return cur_window;
+}
 
-        if (sys) {
-            effective_addr = (uint64_t) qemu_plugin_insn_haddr(insn);
-        } else {
-            effective_addr = (uint64_t) qemu_plugin_insn_vaddr(insn);
-        }
+static void sample_flush_locked(SampleWindow *w)
+{
+    for (int i = 0; i < SAMPLE_LEVELS; i++) {
+        double rate;
 
-        /*
-         * Instructions might get translated multiple times, we do not create
-         * new entries for those instructions. Instead, we fetch the same
-         * entry from the hash table and register it for the callback again.
-         */
-        g_mutex_lock(&hashtable_lock);
-        data = g_hash_table_lookup(miss_ht, GUINT_TO_POINTER(effective_addr));
-        if (data == NULL) {
-            data = g_new0(InsnData, 1);
-            data->disas_str = qemu_plugin_insn_disas(insn);
-            data->symbol = qemu_plugin_insn_symbol(insn);
-            data->addr = effective_addr;
-            g_hash_table_insert(miss_ht, GUINT_TO_POINTER(effective_addr),
-                               (gpointer) data);
+        if (!w->accesses[i]) {
+            continue;
         }
-        g_mutex_unlock(&hashtable_lock);
-
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
-
-        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, data);
+        rate = (double) w->misses[i] / w->accesses[i];
+        sample_stats[i].n++;
+        sample_stats[i].sum += rate;
+        sample_stats[i].sum_sq += rate * rate;
     }
+    memset(w, 0, sizeof(*w));
 }
 
-static void insn_free(gpointer data)
+static void sample_flush(SampleWindow *w)
 {
-    InsnData *insn = (InsnData *) data;
-    g_free(insn->disas_str);
-    g_free(insn);
+    g_mutex_lock(&sample_lock);
+    sample_flush_locked(w);
+    g_mutex_unlock(&sample_lock);
 }
 
-static void cache_free(Cache *cache)
+/* Count the windows that were still open at exit, then free them all */
+static void sample_flush_all(void)
 {
-    for (int i = 0; i < cache->num_sets; i++) {
-        g_free(cache->sets[i].blocks);
-    }
+    g_mutex_lock(&sample_lock);
+    for (GSList *l = sample_windows; l; l = l->next) {
+        SampleWindow *w = l->data;
 
-    if (metadata_destroy) {
-        metadata_destroy(cache);
+        if (w->insns) {
+            sample_flush_locked(w);
+        }
     }
-
-    g_free(cache->sets);
-    g_free(cache);
+    g_slist_free_full(sample_windows, g_free);
+    sample_windows = NULL;
+    g_mutex_unlock(&sample_lock);
 }
 
-static void caches_free(Cache **caches)
+/*
+ * Account for one executed instruction and return whether it, and the
+ * memory accesses it makes, fall in a detailed window.
+ */
+static bool sample_next_insn(void)
 {
-    int i;
+    SampleWindow *w;
 
-    for (i = 0; i < cores; i++) {
-        cache_free(caches[i]);
+    if (!sample_period) {
+        return true;
+    }
+
+    w = get_window();
+    sample_detailed = sample_pos >= sample_period - sample_window;
+    if (sample_detailed) {
+        w->insns++;
+    } else if (w->insns) {
+        sample_flush(w);
+    }
+    if (++sample_pos == sample_period) {
+        sample_pos = 0;
     }
+    return sample_detailed;
 }
 
-static void append_stats_line(GString *line,
-                              uint64_t l1_daccess, uint64_t l1_dmisses,
-                              uint64_t l1_iaccess, uint64_t l1_imisses,
-                              uint64_t l2_access, uint64_t l2_misses)
+static inline bool sample_in_window(void)
 {
-    double l1_dmiss_rate = ((double) l1_dmisses) / (l1_daccess) * 100.0;
-    double l1_imiss_rate = ((double) l1_imisses) / (l1_iaccess) * 100.0;
+    return !sample_period || sample_detailed;
+}
 
-    g_string_append_printf(line, "%-14" PRIu64 " %-12" PRIu64 " %9.4lf%%"
-                           "  %-14" PRIu64 " %-12" PRIu64 " %9.4lf%%",
-                           l1_daccess,
-                           l1_dmisses,
-                           l1_daccess ? l1_dmiss_rate : 0.0,
-                           l1_iaccess,
-                           l1_imisses,
-                           l1_iaccess ? l1_imiss_rate : 0.0);
+static void sample_record(int level, bool hit)
+{
+    if (sample_period) {
+        SampleWindow *w = get_window();
 
-    if (l2_access && l2_misses) {
-        double l2_miss_rate =  ((double) l2_misses) / (l2_access) * 100.0;
-        g_string_append_printf(line,
-                               "  %-12" PRIu64 " %-11" PRIu64 " %10.4lf%%",
-                               l2_access,
-                               l2_misses,
-                               l2_access ? l2_miss_rate : 0.0);
+        w->accesses[level]++;
+        w->misses[level] += !hit;
     }
+}
 
-    g_string_append(line, "\n");
+static inline uint64_t mrc_hash(uint64_t blk)
+{
+    blk ^= blk >> 33;
+    blk *= 0xff51afd7ed558ccdULL;
+    blk ^= blk >> 33;
+    blk *= 0xc4ceb9fe1a85ec53ULL;
+    blk ^= blk >> 33;
+    return blk;
 }
 
-static void sum_stats(void)
+static void mrc_access(int cache_idx, uint64_t addr)
 {
-    int i;
+    uint64_t blk = addr >> l1_dcaches[0]->blksize_shift;
+    MrcState *mrc;
+    GSequenceIter *it;
 
-    g_assert(cores > 1);
-    for (i = 0; i < cores; i++) {
-        l1_imisses += l1_icaches[i]->misses;
-        l1_dmisses += l1_dcaches[i]->misses;
-        l1_imem_accesses += l1_icaches[i]->accesses;
-        l1_dmem_accesses += l1_dcaches[i]->accesses;
+    if ((mrc_hash(blk) & (MRC_HASH_RANGE - 1)) >= mrc_threshold) {
+        return;
+    }
 
-        if (use_l2) {
-            l2_misses += l2_ucaches[i]->misses;
-            l2_mem_accesses += l2_ucaches[i]->accesses;
+    mrc = &mrc_states[cache_idx];
+    g_mutex_lock(&mrc->lock);
+    it = g_hash_table_lookup(mrc->last_access, GUINT_TO_POINTER(blk));
+    if (it) {
+        guint dist = g_sequence_get_length(mrc->stack) -
+                     g_sequence_iter_get_position(it) - 1;
+
+        if (dist >= mrc->hist->len) {
+            g_array_set_size(mrc->hist, dist + 1);
         }
+        g_array_index(mrc->hist, uint64_t, dist)++;
+        g_sequence_remove(it);
+    } else {
+        mrc->cold++;
     }
+    mrc->total++;
+    it = g_sequence_append(mrc->stack, NULL);
+    g_hash_table_insert(mrc->last_access, GUINT_TO_POINTER(blk), it);
+    g_mutex_unlock(&mrc->lock);
 }
 
-static int dcmp(gconstpointer a, gconstpointer b)
+/*
+ * Record where an access was served from and hand it to the registered
+ * hook, if any. Called with no cache lock held.
+ */
+static void publish_outcome(unsigned int vcpu_index, bool is_insn,
+                            uint64_t vaddr, uint64_t addr, Cache *cache,
+                            CacheHitLevel level, int blk)
 {
-    InsnData *insn_a = (InsnData *) a;
-    InsnData *insn_b = (InsnData *) b;
+    CacheAccessOutcome *outcome = &last_outcome;
+    cache_access_hook_fn hook;
 
-    return insn_a->l1_dmisses < insn_b->l1_dmisses ? 1 : -1;
+    if (async_sim) {
+        return;
+    }
+
+    hook = __atomic_load_n(&access_hook, __ATOMIC_ACQUIRE);
+
+    outcome->vaddr = vaddr;
+    outcome->addr = addr;
+    outcome->level = level;
+    outcome->insn = is_insn;
+    if (level == CACHE_HIT_MEM) {
+        outcome->set = -1;
+        outcome->way = -1;
+    } else {
+        outcome->set = extract_set(cache, addr);
+        outcome->way = blk;
+    }
+
+    if (hook) {
+        hook(vcpu_index, outcome);
+    }
 }
 
-static int icmp(gconstpointer a, gconstpointer b)
+static void simulate_data_access(unsigned int vcpu_index, uint64_t vaddr,
+                                 uint64_t effective_addr, InsnData *insn)
 {
-    InsnData *insn_a = (InsnData *) a;
-    InsnData *insn_b = (InsnData *) b;
+    int cache_idx, blk;
+    bool hit_in_l1, hit_in_l2;
+    bool detailed = sample_in_window();
+
+    cache_idx = vcpu_index % cores;
+
+    g_mutex_lock(&l1_dcache_locks[cache_idx]);
+    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr, &blk);
+    prefetch(l1_dprefetch, &l1_dpf[cache_idx], l1_dcaches[cache_idx],
+             insn->addr, effective_addr, hit_in_l1);
+    if (detailed) {
+        if (!hit_in_l1) {
+            __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
+            l1_dcaches[cache_idx]->misses++;
+        }
+        l1_dcaches[cache_idx]->accesses++;
+    }
+    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+    if (detailed) {
+        sample_record(SAMPLE_L1D, hit_in_l1);
+    }
+    if (mrc_states) {
+        mrc_access(cache_idx, effective_addr);
+    }
+
+    if (hit_in_l1 || !use_l2) {
+        /* No need to access L2 */
+        publish_outcome(vcpu_index, false, vaddr, effective_addr,
+                        l1_dcaches[cache_idx],
+                        hit_in_l1 ? CACHE_HIT_L1 : CACHE_HIT_MEM, blk);
+        return;
+    }
+
+    g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    hit_in_l2 = access_cache(l2_ucaches[cache_idx], effective_addr, &blk);
+    prefetch(l2_prefetch, &l2_pf[cache_idx], l2_ucaches[cache_idx],
+             insn->addr, effective_addr, hit_in_l2);
+    if (detailed) {
+        if (!hit_in_l2) {
+            __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
+            l2_ucaches[cache_idx]->misses++;
+        }
+        l2_ucaches[cache_idx]->accesses++;
+    }
+    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    if (detailed) {
+        sample_record(SAMPLE_L2, hit_in_l2);
+    }
+
+    publish_outcome(vcpu_index, false, vaddr, effective_addr,
+                    l2_ucaches[cache_idx],
+                    hit_in_l2 ? CACHE_HIT_L2 : CACHE_HIT_MEM, blk);
+}
+
+static void simulate_insn_fetch(unsigned int vcpu_index, uint64_t vaddr,
+                                InsnData *insn)
+{
+    uint64_t insn_addr;
+    int cache_idx, blk;
+    bool hit_in_l1, hit_in_l2;
+    bool detailed = sample_next_insn();
+
+    insn_addr = insn->addr;
+
+    cache_idx = vcpu_index % cores;
+    g_mutex_lock(&l1_icache_locks[cache_idx]);
+    hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr, &blk);
+    prefetch(l1_iprefetch, &l1_ipf[cache_idx], l1_icaches[cache_idx],
+             insn_addr, insn_addr, hit_in_l1);
+    if (detailed) {
+        if (!hit_in_l1) {
+            __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
+            l1_icaches[cache_idx]->misses++;
+        }
+        l1_icaches[cache_idx]->accesses++;
+    }
+    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+    if (detailed) {
+        sample_record(SAMPLE_L1I, hit_in_l1);
+    }
+
+    if (hit_in_l1 || !use_l2) {
+        /* No need to access L2 */
+        publish_outcome(vcpu_index, true, vaddr, insn_addr,
+                        l1_icaches[cache_idx],
+                        hit_in_l1 ? CACHE_HIT_L1 : CACHE_HIT_MEM, blk);
+        return;
+    }
+
+    g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    hit_in_l2 = access_cache(l2_ucaches[cache_idx], insn_addr, &blk);
+    prefetch(l2_prefetch, &l2_pf[cache_idx], l2_ucaches[cache_idx],
+             insn_addr, insn_addr, hit_in_l2);
+    if (detailed) {
+        if (!hit_in_l2) {
+            __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
+            l2_ucaches[cache_idx]->misses++;
+        }
+        l2_ucaches[cache_idx]->accesses++;
+    }
+    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    if (detailed) {
+        sample_record(SAMPLE_L2, hit_in_l2);
+    }
+
+    publish_outcome(vcpu_index, true, vaddr, insn_addr,
+                    l2_ucaches[cache_idx],
+                    hit_in_l2 ? CACHE_HIT_L2 : CACHE_HIT_MEM, blk);
+}
+
+/*
+ * Decoupled simulation: with async=on, the vCPU callbacks only append a
+ * record of each access to a ring owned by their thread, and simulator
+ * threads replay the rings against the model. Each ring has a single
+ * producer and a single consumer (ring i is drained by simulator thread
+ * i % sim_threads), so they need no lock. A full ring makes its vCPU wait.
+ * Once the simulator threads are stopped, accesses are simulated by the
+ * vCPU itself as with async=off.
+ *
+ * As the outcome of an access is only known later, the access hook is
+ * not called in this mode, and sampling state belongs to the simulator
+ * threads.
+ */
+typedef struct {
+    /* effective address of a data access, vaddr of an instruction fetch */
+    uint64_t addr;
+    InsnData *insn;
+    uint32_t vcpu_index;
+    bool is_insn;
+} AccessRecord;
+
+#define RING_SIZE (1 << 16)
+#define MAX_RINGS 256
+
+typedef struct {
+    AccessRecord recs[RING_SIZE];
+    /* written by the vCPU thread */
+    uint64_t head;
+    /* keep head and tail in separate cache lines */
+    char pad[64];
+    /* written by the simulator thread */
+    uint64_t tail;
+} AccessRing;
+
+static int n_sim_threads = 1;
+static GThread **sim_threads;
+static bool sim_stop;
+/* set while the simulator threads consume the rings */
+static bool sim_running;
+
+/* parking of the simulator threads, see async_park() */
+static GMutex sim_park_lock;
+static GCond sim_park_cond;
+static bool sim_park;
+static int sim_parked;
+static AccessRing *rings[MAX_RINGS];
+static int n_rings;
+static GMutex rings_lock;
+
+static __thread AccessRing *my_ring;
+static __thread bool my_ring_failed;
+
+/* Return this thread's ring, or NULL if there are too many threads */
+static AccessRing *get_ring(void)
+{
+    if (G_UNLIKELY(!my_ring && !my_ring_failed)) {
+        g_mutex_lock(&rings_lock);
+        if (n_rings < MAX_RINGS) {
+            my_ring = g_new0(AccessRing, 1);
+            rings[n_rings] = my_ring;
+            __atomic_store_n(&n_rings, n_rings + 1, __ATOMIC_RELEASE);
+        } else {
+            my_ring_failed = true;
+        }
+        g_mutex_unlock(&rings_lock);
+    }
+    return my_ring;
+}
+
+/*
+ * Queue an access for the simulator threads. Returns false if it must be
+ * simulated synchronously instead, because there is no ring for this
+ * thread or nothing consumes the rings anymore.
+ */
+static bool ring_push(uint64_t addr, InsnData *insn,
+                      unsigned int vcpu_index, bool is_insn)
+{
+    AccessRing *ring;
+    uint64_t head;
+    AccessRecord *rec;
+
+    if (!__atomic_load_n(&sim_running, __ATOMIC_ACQUIRE) ||
+        !(ring = get_ring())) {
+        return false;
+    }
+
+    head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+           RING_SIZE) {
+        if (!__atomic_load_n(&sim_running, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        g_thread_yield();
+    }
+
+    rec = &ring->recs[head & (RING_SIZE - 1)];
+    rec->addr = addr;
+    rec->insn = insn;
+    rec->vcpu_index = vcpu_index;
+    rec->is_insn = is_insn;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Replay the pending records of @ring, returning how many there were */
+static uint64_t ring_drain(AccessRing *ring)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t n = head - tail;
+
+    for (; tail != head; tail++) {
+        AccessRecord *rec = &ring->recs[tail & (RING_SIZE - 1)];
+
+        if (rec->is_insn) {
+            simulate_insn_fetch(rec->vcpu_index, rec->addr, rec->insn);
+        } else {
+            simulate_data_access(rec->vcpu_index, 0, rec->addr, rec->insn);
+        }
+        /* let the producer reuse the slots early */
+        if ((tail & 1023) == 1023) {
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+static gpointer sim_thread_fn(gpointer opaque)
+{
+    int idx = GPOINTER_TO_INT(opaque);
+
+    for (;;) {
+        bool stop = __atomic_load_n(&sim_stop, __ATOMIC_ACQUIRE);
+        int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+        uint64_t done = 0;
+
+        if (__atomic_load_n(&sim_park, __ATOMIC_ACQUIRE)) {
+            g_mutex_lock(&sim_park_lock);
+            sim_parked++;
+            g_cond_broadcast(&sim_park_cond);
+            while (sim_park) {
+                g_cond_wait(&sim_park_cond, &sim_park_lock);
+            }
+            sim_parked--;
+            g_mutex_unlock(&sim_park_lock);
+            continue;
+        }
+
+        for (int i = idx; i < n; i += n_sim_threads) {
+            done += ring_drain(rings[i]);
+        }
+        if (stop && !done) {
+            return NULL;
+        }
+        if (!done) {
+            g_usleep(50);
+        }
+    }
+}
+
+/* Wait until the simulator threads have replayed every pending record */
+static void async_quiesce(void)
+{
+    int n = __atomic_load_n(&n_rings, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < n; i++) {
+        while (__atomic_load_n(&rings[i]->tail, __ATOMIC_ACQUIRE) !=
+               __atomic_load_n(&rings[i]->head, __ATOMIC_ACQUIRE)) {
+            g_usleep(50);
+        }
+    }
+}
+
+/*
+ * Replay every pending record and stop the simulator threads until
+ * async_unpark(), so that the model can be modified from another thread.
+ * The vCPUs must be stopped.
+ */
+static void async_park(void)
+{
+    if (!__atomic_load_n(&sim_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    async_quiesce();
+    g_mutex_lock(&sim_park_lock);
+    __atomic_store_n(&sim_park, true, __ATOMIC_RELEASE);
+    while (sim_parked < n_sim_threads) {
+        g_cond_wait(&sim_park_cond, &sim_park_lock);
+    }
+    g_mutex_unlock(&sim_park_lock);
+}
+
+static void async_unpark(void)
+{
+    g_mutex_lock(&sim_park_lock);
+    __atomic_store_n(&sim_park, false, __ATOMIC_RELEASE);
+    g_cond_broadcast(&sim_park_cond);
+    g_mutex_unlock(&sim_park_lock);
+}
+
+static void async_start(void)
+{
+    sim_threads = g_new(GThread *, n_sim_threads);
+    for (int i = 0; i < n_sim_threads; i++) {
+        sim_threads[i] = g_thread_new("cache-sim", sim_thread_fn,
+                                      GINT_TO_POINTER(i));
+    }
+    __atomic_store_n(&sim_running, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called from the atexit callback, which also runs when the plugin is
+ * unloaded. No vCPU is executing guest code then: they are stopped in
+ * system emulation, and with user emulation the callbacks have been
+ * removed and the code cache flushed. Any vCPU getting here anyway finds
+ * sim_running clear and simulates its accesses itself.
+ */
+static void async_stop(void)
+{
+    __atomic_store_n(&sim_running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&sim_stop, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < n_sim_threads; i++) {
+        g_thread_join(sim_threads[i]);
+    }
+    g_free(sim_threads);
+    sim_threads = NULL;
+
+    g_mutex_lock(&rings_lock);
+    for (int i = 0; i < n_rings; i++) {
+        g_free(rings[i]);
+        rings[i] = NULL;
+    }
+    n_rings = 0;
+    g_mutex_unlock(&rings_lock);
+}
+
+static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *userdata)
+{
+    uint64_t effective_addr;
+    struct qemu_plugin_hwaddr *hwaddr;
+
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+        return;
+    }
+
+    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+
+    if (effective_addr > __atomic_load_n(&max_effective_addr,
+                                         __ATOMIC_RELAXED)) {
+        __atomic_store_n(&max_effective_addr, effective_addr,
+                         __ATOMIC_RELAXED);
+    }
+
+    if (!async_sim || !ring_push(effective_addr, userdata, vcpu_index,
+                                 false)) {
+        simulate_data_access(vcpu_index, vaddr, effective_addr, userdata);
+    }
+}
+
+static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+{
+    InsnAlias *alias = userdata;
+
+    if (!async_sim || !ring_push(alias->vaddr, alias->insn, vcpu_index,
+                                 true)) {
+        simulate_insn_fetch(vcpu_index, alias->vaddr, alias->insn);
+    }
+}
+
+static void insn_free(gpointer data)
+{
+    InsnData *insn = (InsnData *) data;
+    g_hash_table_destroy(insn->aliases);
+    g_free(insn->disas_str);
+    g_free(insn);
+}
+
+static InsnAlias *get_insn_alias(InsnData *insn, uint64_t vaddr)
+{
+    InsnAlias *alias = g_hash_table_lookup(insn->aliases,
+                                           GUINT_TO_POINTER(vaddr));
+
+    if (!alias) {
+        alias = g_new(InsnAlias, 1);
+        alias->insn = insn;
+        alias->vaddr = vaddr;
+        g_hash_table_insert(insn->aliases, GUINT_TO_POINTER(vaddr), alias);
+    }
+    return alias;
+}
+
+static GHashTable *get_miss_ht(void)
+{
+    if (!miss_ht) {
+        miss_ht = g_hash_table_new_full(NULL, g_direct_equal, NULL, insn_free);
+        g_mutex_lock(&miss_tables_lock);
+        miss_tables = g_slist_prepend(miss_tables, miss_ht);
+        g_mutex_unlock(&miss_tables_lock);
+    }
+    return miss_ht;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    GHashTable *ht = get_miss_ht();
+    size_t n_insns;
+    size_t i;
+    InsnData *data;
+    InsnAlias *alias;
+
+    n_insns = qemu_plugin_tb_n_insns(tb);
+    for (i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        uint64_t effective_addr;
+
+        if (sys) {
+            effective_addr = (uint64_t) qemu_plugin_insn_haddr(insn);
+        } else {
+            effective_addr = (uint64_t) qemu_plugin_insn_vaddr(insn);
+        }
+
+        /*
+         * Instructions might get translated multiple times, we do not create
+         * new entries for those instructions. Instead, we fetch the same
+         * entry from the hash table and register it for the callback again.
+         * Another thread translating the same instruction gets its own
+         * entry, which is folded into this one at exit.
+         */
+        data = g_hash_table_lookup(ht, GUINT_TO_POINTER(effective_addr));
+        if (data == NULL) {
+            data = g_new0(InsnData, 1);
+            data->disas_str = qemu_plugin_insn_disas(insn);
+            data->symbol = qemu_plugin_insn_symbol(insn);
+            data->addr = effective_addr;
+            data->aliases = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+            g_hash_table_insert(ht, GUINT_TO_POINTER(effective_addr),
+                               (gpointer) data);
+        }
+        alias = get_insn_alias(data, qemu_plugin_insn_vaddr(insn));
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         rw, data);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, alias);
+    }
+}
+
+static void cache_free(Cache *cache)
+{
+    for (int i = 0; i < cache->num_sets; i++) {
+        g_free(cache->sets[i].blocks);
+    }
+    g_free(cache->resident);
+
+    if (metadata_destroy) {
+        metadata_destroy(cache);
+    }
+
+    g_free(cache->sets);
+    g_free(cache);
+}
+
+static void caches_free(Cache **caches)
+{
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        cache_free(caches[i]);
+    }
+}
+
+static void append_stats_line(GString *line,
+                              uint64_t l1_daccess, uint64_t l1_dmisses,
+                              uint64_t l1_iaccess, uint64_t l1_imisses,
+                              uint64_t l2_access, uint64_t l2_misses)
+{
+    double l1_dmiss_rate = ((double) l1_dmisses) / (l1_daccess) * 100.0;
+    double l1_imiss_rate = ((double) l1_imisses) / (l1_iaccess) * 100.0;
+
+    g_string_append_printf(line, "%-14" PRIu64 " %-12" PRIu64 " %9.4lf%%"
+                           "  %-14" PRIu64 " %-12" PRIu64 " %9.4lf%%",
+                           l1_daccess,
+                           l1_dmisses,
+                           l1_daccess ? l1_dmiss_rate : 0.0,
+                           l1_iaccess,
+                           l1_imisses,
+                           l1_iaccess ? l1_imiss_rate : 0.0);
+
+    if (l2_access && l2_misses) {
+        double l2_miss_rate =  ((double) l2_misses) / (l2_access) * 100.0;
+        g_string_append_printf(line,
+                               "  %-12" PRIu64 " %-11" PRIu64 " %10.4lf%%",
+                               l2_access,
+                               l2_misses,
+                               l2_access ? l2_miss_rate : 0.0);
+    }
+
+    g_string_append(line, "\n");
+}
+
+static void sum_stats(void)
+{
+    int i;
+
+    g_assert(cores > 1);
+    for (i = 0; i < cores; i++) {
+        l1_imisses += l1_icaches[i]->misses;
+        l1_dmisses += l1_dcaches[i]->misses;
+        l1_imem_accesses += l1_icaches[i]->accesses;
+        l1_dmem_accesses += l1_dcaches[i]->accesses;
+
+        if (use_l2) {
+            l2_misses += l2_ucaches[i]->misses;
+            l2_mem_accesses += l2_ucaches[i]->accesses;
+        }
+    }
+}
+
+static int dcmp(gconstpointer a, gconstpointer b)
+{
+    InsnData *insn_a = (InsnData *) a;
+    InsnData *insn_b = (InsnData *) b;
+
+    return insn_a->l1_dmisses < insn_b->l1_dmisses ? 1 : -1;
+}
+
+static int icmp(gconstpointer a, gconstpointer b)
+{
+    InsnData *insn_a = (InsnData *) a;
+    InsnData *insn_b = (InsnData *) b;
 
     return insn_a->l1_imisses < insn_b->l1_imisses ? 1 : -1;
 }
@@ -686,13 +1499,43 @@ static void log_stats(void)
     qemu_plugin_outs(rep->str);
 }
 
+/*
+ * Fold the per-thread tables into one entry per address. The counts are
+ * added to the first entry seen, which is fine as this only runs at exit.
+ */
+static GList *merge_miss_tables(void)
+{
+    g_autoptr(GHashTable) merged = g_hash_table_new(NULL, NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    GSList *t;
+
+    for (t = miss_tables; t; t = t->next) {
+        g_hash_table_iter_init(&iter, t->data);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            InsnData *insn = value;
+            InsnData *first = g_hash_table_lookup(merged, key);
+
+            if (first) {
+                first->l1_dmisses += insn->l1_dmisses;
+                first->l1_imisses += insn->l1_imisses;
+                first->l2_misses += insn->l2_misses;
+            } else {
+                g_hash_table_insert(merged, key, insn);
+            }
+        }
+    }
+
+    return g_hash_table_get_values(merged);
+}
+
 static void log_top_insns(void)
 {
     int i;
     GList *curr, *miss_insns;
     InsnData *insn;
 
-    miss_insns = g_hash_table_get_values(miss_ht);
+    miss_insns = merge_miss_tables();
     miss_insns = g_list_sort(miss_insns, dcmp);
     g_autoptr(GString) rep = g_string_new("");
     g_string_append_printf(rep, "%s", "address, data misses, instruction\n");
@@ -742,9 +1585,170 @@ finish:
     g_list_free(miss_insns);
 }
 
+/*
+ * Report the mean of the per-window miss rates with a 95% confidence
+ * interval, using the normal approximation (SMARTS aims for at least 30
+ * windows, for which it holds).
+ */
+static void log_sampling(void)
+{
+    static const char *names[SAMPLE_LEVELS] = { "l1d", "l1i", "l2" };
+    g_autoptr(GString) rep = g_string_new("");
+
+    g_string_append_printf(rep, "sampling: %" PRIu64 " detailed instructions"
+                           " every %" PRIu64 "\n", sample_window,
+                           sample_period);
+
+    for (int i = 0; i < SAMPLE_LEVELS; i++) {
+        SampleStat *st = &sample_stats[i];
+        double mean, var;
+
+        if (i == SAMPLE_L2 && !use_l2) {
+            continue;
+        }
+        if (st->n < 2) {
+            g_string_append_printf(rep, "%-4s miss rate: not enough windows"
+                                   " (%" PRIu64 ")\n", names[i], st->n);
+            continue;
+        }
+        mean = st->sum / st->n;
+        var = (st->sum_sq - st->sum * mean) / (st->n - 1);
+        g_string_append_printf(rep, "%-4s miss rate: %.4lf%% +/- %.4lf%%"
+                               " (95%% confidence, %" PRIu64 " windows)\n",
+                               names[i], mean * 100.0,
+                               1.96 * sqrt(MAX(var, 0.0) / st->n) * 100.0,
+                               st->n);
+    }
+
+    g_string_append(rep, "\n");
+    qemu_plugin_outs(rep->str);
+}
+
+/*
+ * Print the data miss ratio of a fully associative LRU cache of each power
+ * of two size, from the reuse distance histograms of all cores. A block
+ * reused after d other distinct blocks misses in any cache of at most d
+ * blocks.
+ */
+static void log_mrc(void)
+{
+    g_autoptr(GString) rep = g_string_new("data cache size, miss ratio\n");
+    g_autoptr(GArray) hist = g_array_new(false, true, sizeof(uint64_t));
+    uint64_t cold = 0, total = 0, misses;
+    uint64_t blksize = 1ULL << l1_dcaches[0]->blksize_shift;
+    uint64_t max_blocks;
+
+    for (int i = 0; i < cores; i++) {
+        MrcState *mrc = &mrc_states[i];
+
+        if (mrc->hist->len > hist->len) {
+            g_array_set_size(hist, mrc->hist->len);
+        }
+        for (guint d = 0; d < mrc->hist->len; d++) {
+            g_array_index(hist, uint64_t, d) +=
+                g_array_index(mrc->hist, uint64_t, d);
+        }
+        cold += mrc->cold;
+        total += mrc->total;
+    }
+
+    if (!total) {
+        return;
+    }
+
+    max_blocks = (uint64_t)(hist->len / mrc_rate) + 1;
+    for (uint64_t blocks = 1; blocks <= 2 * max_blocks; blocks *= 2) {
+        misses = cold;
+        for (guint d = 0; d < hist->len; d++) {
+            if (d / mrc_rate >= blocks) {
+                misses += g_array_index(hist, uint64_t, d);
+            }
+        }
+        g_string_append_printf(rep, "%-15" PRIu64 " %.4lf%%\n",
+                               blocks * blksize,
+                               (double) misses / total * 100.0);
+    }
+
+    g_string_append(rep, "\n");
+    qemu_plugin_outs(rep->str);
+}
+
+static void mrc_free(void)
+{
+    for (int i = 0; i < cores; i++) {
+        g_hash_table_destroy(mrc_states[i].last_access);
+        g_sequence_free(mrc_states[i].stack);
+        g_array_free(mrc_states[i].hist, true);
+    }
+    g_free(mrc_states);
+}
+
+static void append_prefetch_line(GString *rep, const char *name,
+                                 Cache **caches)
+{
+    PrefetchStats sum = { 0 };
+
+    for (int i = 0; i < cores; i++) {
+        sum.issued += caches[i]->pf.issued;
+        sum.useful += caches[i]->pf.useful;
+        sum.polluting += caches[i]->pf.polluting;
+        sum.misses += caches[i]->pf.misses;
+    }
+
+    g_string_append_printf(rep, "%-4s %-14" PRIu64 " %-12" PRIu64
+                           " %9.4lf%% %9.4lf%%  %" PRIu64 "\n",
+                           name, sum.issued, sum.useful,
+                           sum.issued ?
+                           (double) sum.useful / sum.issued * 100.0 : 0.0,
+                           sum.useful + sum.misses ?
+                           (double) sum.useful / (sum.useful + sum.misses) *
+                           100.0 : 0.0,
+                           sum.polluting);
+}
+
+/*
+ * Accuracy is the share of prefetched lines used before being evicted,
+ * coverage the share of would-be misses that a prefetch turned into hits,
+ * and pollution the misses on lines a prefetch had evicted.
+ */
+static void log_prefetch(void)
+{
+    g_autoptr(GString) rep = g_string_new("prefetch, issued, useful,"
+                                          " accuracy, coverage, pollution\n");
+
+    if (l1_dprefetch != PF_NONE) {
+        append_prefetch_line(rep, "l1d", l1_dcaches);
+    }
+    if (l1_iprefetch != PF_NONE) {
+        append_prefetch_line(rep, "l1i", l1_icaches);
+    }
+    if (use_l2 && l2_prefetch != PF_NONE) {
+        append_prefetch_line(rep, "l2", l2_ucaches);
+    }
+
+    g_string_append(rep, "\n");
+    qemu_plugin_outs(rep->str);
+}
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    if (async_sim) {
+        async_stop();
+    }
+
     log_stats();
+    if (l1_dprefetch != PF_NONE || l1_iprefetch != PF_NONE ||
+        (use_l2 && l2_prefetch != PF_NONE)) {
+        log_prefetch();
+    }
+    if (sample_period) {
+        sample_flush_all();
+        log_sampling();
+    }
+    if (mrc_states) {
+        log_mrc();
+        mrc_free();
+    }
     log_top_insns();
 
     caches_free(l1_dcaches);
@@ -758,7 +1762,301 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
         g_free(l2_ucache_locks);
     }
 
-    g_hash_table_destroy(miss_ht);
+    g_free(l1_dpf);
+    g_free(l1_ipf);
+    g_free(l2_pf);
+
+    g_slist_free_full(miss_tables, (GDestroyNotify) g_hash_table_destroy);
+}
+
+/*
+ * Cache contents can be carried in VM snapshots, so that a run restored
+ * with -loadvm starts with the residency the guest had when it was saved.
+ *
+ * The section holds a single blob of big-endian 64 bit words, prefixed by
+ * its length so that it can be skipped when the configuration differs:
+ * the geometry of each level, then for every cache the tag and flags of
+ * each block followed by the prefetch victim and the replacement metadata
+ * of each set. Access and miss counters are not part of it.
+ *
+ * Version 1 had neither the prefetched flag nor the prefetch victim.
+ */
+#define CACHE_VMSTATE_VERSION 2
+
+#define VMSTATE_BLK_VALID       1
+#define VMSTATE_BLK_PREFETCHED  2
+
+static void vmstate_push(GArray *words, uint64_t val)
+{
+    val = GUINT64_TO_BE(val);
+    g_array_append_val(words, val);
+}
+
+static void vmstate_save_geometry(GArray *words, Cache **caches)
+{
+    vmstate_push(words, caches ? caches[0]->num_sets : 0);
+    vmstate_push(words, caches ? caches[0]->assoc : 0);
+    vmstate_push(words, caches ? caches[0]->blksize_shift : 0);
+}
+
+static void vmstate_save_caches(GArray *words, Cache **caches)
+{
+    for (int c = 0; caches && c < cores; c++) {
+        Cache *cache = caches[c];
+
+        for (int i = 0; i < cache->num_sets; i++) {
+            CacheSet *set = &cache->sets[i];
+
+            for (int j = 0; j < cache->assoc; j++) {
+                vmstate_push(words, set->blocks[j].tag);
+                vmstate_push(words,
+                             (set->blocks[j].valid ? VMSTATE_BLK_VALID : 0) |
+                             (set->blocks[j].prefetched ?
+                              VMSTATE_BLK_PREFETCHED : 0));
+            }
+            vmstate_push(words, set->pf_victim_valid);
+            vmstate_push(words, set->pf_victim);
+            switch (policy) {
+            case LRU:
+                vmstate_push(words, set->lru_gen_counter);
+                for (int j = 0; j < cache->assoc; j++) {
+                    vmstate_push(words, set->lru_priorities[j]);
+                }
+                break;
+            case FIFO:
+                vmstate_push(words, g_queue_get_length(set->fifo_queue));
+                for (GList *l = set->fifo_queue->head; l; l = l->next) {
+                    vmstate_push(words, GPOINTER_TO_INT(l->data));
+                }
+                break;
+            case RAND:
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Called with the VM stopped, so no vCPU is touching the caches. The
+ * simulator threads are parked in the meantime.
+ */
+static void cache_vmstate_save(qemu_plugin_id_t id,
+                               struct qemu_plugin_vmstate_stream *s,
+                               void *userdata)
+{
+    g_autoptr(GArray) words = g_array_new(false, false, sizeof(uint64_t));
+
+    if (async_sim) {
+        async_park();
+    }
+
+    vmstate_push(words, cores);
+    vmstate_push(words, policy);
+    vmstate_save_geometry(words, l1_dcaches);
+    vmstate_save_geometry(words, l1_icaches);
+    vmstate_save_geometry(words, use_l2 ? l2_ucaches : NULL);
+
+    vmstate_save_caches(words, l1_dcaches);
+    vmstate_save_caches(words, l1_icaches);
+    vmstate_save_caches(words, use_l2 ? l2_ucaches : NULL);
+
+    if (async_sim) {
+        async_unpark();
+    }
+
+    qemu_plugin_vmstate_put_u64(s, words->len);
+    qemu_plugin_vmstate_put(s, words->data, words->len * sizeof(uint64_t));
+}
+
+typedef struct {
+    const uint64_t *words;
+    size_t len;
+    size_t pos;
+} VMStateCursor;
+
+static bool vmstate_pop(VMStateCursor *cur, uint64_t *val)
+{
+    if (cur->pos == cur->len) {
+        return false;
+    }
+    *val = GUINT64_FROM_BE(cur->words[cur->pos++]);
+    return true;
+}
+
+static bool vmstate_check_geometry(VMStateCursor *cur, Cache **caches)
+{
+    uint64_t num_sets, assoc, blksize_shift;
+
+    return vmstate_pop(cur, &num_sets) &&
+           vmstate_pop(cur, &assoc) &&
+           vmstate_pop(cur, &blksize_shift) &&
+           num_sets == (caches ? caches[0]->num_sets : 0) &&
+           assoc == (caches ? caches[0]->assoc : 0) &&
+           blksize_shift == (caches ? caches[0]->blksize_shift : 0);
+}
+
+static bool vmstate_load_caches(VMStateCursor *cur, Cache **caches,
+                                int version)
+{
+    uint64_t val, n;
+
+    for (int c = 0; caches && c < cores; c++) {
+        Cache *cache = caches[c];
+
+        cache->n_resident = 0;
+        for (int i = 0; i < cache->num_sets; i++) {
+            CacheSet *set = &cache->sets[i];
+
+            for (int j = 0; j < cache->assoc; j++) {
+                if (!vmstate_pop(cur, &set->blocks[j].tag) ||
+                    !vmstate_pop(cur, &val)) {
+                    return false;
+                }
+                set->blocks[j].valid = val & VMSTATE_BLK_VALID;
+                set->blocks[j].prefetched = val & VMSTATE_BLK_PREFETCHED;
+                if (set->blocks[j].valid) {
+                    resident_add(cache, i, j);
+                }
+            }
+            if (version < 2) {
+                set->pf_victim_valid = false;
+            } else if (!vmstate_pop(cur, &val) ||
+                       !vmstate_pop(cur, &set->pf_victim)) {
+                return false;
+            } else {
+                set->pf_victim_valid = val;
+            }
+            switch (policy) {
+            case LRU:
+                if (!vmstate_pop(cur, &set->lru_gen_counter)) {
+                    return false;
+                }
+                for (int j = 0; j < cache->assoc; j++) {
+                    if (!vmstate_pop(cur, &set->lru_priorities[j])) {
+                        return false;
+                    }
+                }
+                break;
+            case FIFO:
+                g_queue_clear(set->fifo_queue);
+                if (!vmstate_pop(cur, &n) || n > cache->assoc) {
+                    return false;
+                }
+                while (n--) {
+                    if (!vmstate_pop(cur, &val) || val >= cache->assoc) {
+                        return false;
+                    }
+                    g_queue_push_tail(set->fifo_queue, GINT_TO_POINTER(val));
+                }
+                break;
+            case RAND:
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/* Drop every line of @caches along with its replacement state */
+static void caches_invalidate(Cache **caches)
+{
+    for (int c = 0; caches && c < cores; c++) {
+        Cache *cache = caches[c];
+
+        cache->n_resident = 0;
+        for (int i = 0; i < cache->num_sets; i++) {
+            CacheSet *set = &cache->sets[i];
+
+            memset(set->blocks, 0, cache->assoc * sizeof(CacheBlock));
+            set->pf_victim_valid = false;
+            switch (policy) {
+            case LRU:
+                memset(set->lru_priorities, 0,
+                       cache->assoc * sizeof(uint64_t));
+                set->lru_gen_counter = 0;
+                break;
+            case FIFO:
+                g_queue_clear(set->fifo_queue);
+                break;
+            case RAND:
+                break;
+            }
+        }
+    }
+}
+
+static int cache_vmstate_load(qemu_plugin_id_t id,
+                              struct qemu_plugin_vmstate_stream *s,
+                              int version, void *userdata)
+{
+    uint64_t len = qemu_plugin_vmstate_get_u64(s);
+    g_autofree uint64_t *words = g_try_new(uint64_t, len);
+    VMStateCursor cur = { .words = words, .len = len };
+    uint64_t saved_cores, saved_policy;
+    bool match, ok;
+
+    if (len && !words) {
+        return -ENOMEM;
+    }
+    if (!qemu_plugin_vmstate_get(s, words, len * sizeof(uint64_t))) {
+        return -EIO;
+    }
+
+    /* the simulator threads must not touch the sets while they change */
+    if (async_sim) {
+        async_park();
+    }
+
+    match = vmstate_pop(&cur, &saved_cores) && saved_cores == cores &&
+            vmstate_pop(&cur, &saved_policy) && saved_policy == policy &&
+            vmstate_check_geometry(&cur, l1_dcaches) &&
+            vmstate_check_geometry(&cur, l1_icaches) &&
+            vmstate_check_geometry(&cur, use_l2 ? l2_ucaches : NULL);
+    ok = !match ||
+         (vmstate_load_caches(&cur, l1_dcaches, version) &&
+          vmstate_load_caches(&cur, l1_icaches, version) &&
+          vmstate_load_caches(&cur, use_l2 ? l2_ucaches : NULL, version) &&
+          cur.pos == cur.len);
+
+    if (!match) {
+        fprintf(stderr, "cache: snapshot was taken with a different cache "
+                "configuration, starting with empty caches\n");
+    } else if (!ok) {
+        fprintf(stderr, "cache: malformed vmstate section\n");
+    }
+    /* never keep the contents the caches had before the load */
+    if (!match || !ok) {
+        caches_invalidate(l1_dcaches);
+        caches_invalidate(l1_icaches);
+        caches_invalidate(use_l2 ? l2_ucaches : NULL);
+    }
+    /* prefetcher training is not saved, start it over */
+    memset(l1_dpf, 0, cores * sizeof(Prefetcher));
+    memset(l1_ipf, 0, cores * sizeof(Prefetcher));
+    if (use_l2) {
+        memset(l2_pf, 0, cores * sizeof(Prefetcher));
+    }
+
+    if (async_sim) {
+        async_unpark();
+    }
+    return ok ? 0 : -EINVAL;
+}
+
+static bool parse_prefetch(const char *name, PrefetchKind *kind)
+{
+    if (g_strcmp0(name, "none") == 0) {
+        *kind = PF_NONE;
+    } else if (g_strcmp0(name, "nextline") == 0) {
+        *kind = PF_NEXTLINE;
+    } else if (g_strcmp0(name, "stride") == 0) {
+        *kind = PF_STRIDE;
+    } else if (g_strcmp0(name, "stream") == 0) {
+        *kind = PF_STREAM;
+    } else {
+        return false;
+    }
+    return true;
 }
 
 static void policy_init(void)
@@ -784,7 +2082,7 @@ static void policy_init(void)
 }
 
 /* Check whether a physical address resides in a given cache level. */
-QEMU_PLUGIN_EXPORT bool cache_is_in_l1d(uint64_t addr, int core_idx)
+static bool cache_is_in_l1d(uint64_t addr, int core_idx)
 {
     int idx = core_idx % cores;
     g_mutex_lock(&l1_dcache_locks[idx]);
@@ -793,7 +2091,7 @@ QEMU_PLUGIN_EXPORT bool cache_is_in_l1d(uint64_t addr, int core_idx)
     return hit;
 }
 
-QEMU_PLUGIN_EXPORT bool cache_is_in_l1i(uint64_t addr, int core_idx)
+static bool cache_is_in_l1i(uint64_t addr, int core_idx)
 {
     int idx = core_idx % cores;
     g_mutex_lock(&l1_icache_locks[idx]);
@@ -802,7 +2100,7 @@ QEMU_PLUGIN_EXPORT bool cache_is_in_l1i(uint64_t addr, int core_idx)
     return hit;
 }
 
-QEMU_PLUGIN_EXPORT bool cache_is_in_l2(uint64_t addr, int core_idx)
+static bool cache_is_in_l2(uint64_t addr, int core_idx)
 {
     if (!use_l2) {
         return false;
@@ -814,143 +2112,139 @@ QEMU_PLUGIN_EXPORT bool cache_is_in_l2(uint64_t addr, int core_idx)
     return hit;
 }
 
-static char *plugin_monitor_cmd(const char *plugin_name,
-                                const char *command)
+/*
+ * Outcome of the most recent access simulated on the calling vCPU thread.
+ * Lets other plugins classify an access without probing the caches again.
+ */
+static const CacheAccessOutcome *cache_last_outcome(void)
 {
-    if (g_strcmp0(plugin_name, "cache") == 0) {
-        char* ret = malloc(32);
+    return &last_outcome;
+}
 
-        if (g_strcmp0(command, "get_l1_addr") == 0) {
-            size_t *cache_order = random_indices(cores, cores);
+/*
+ * Register @hook to be called after every simulated access. Only a single
+ * consumer is supported; pass NULL to remove it. With async=on accesses
+ * are simulated away from the vCPU that made them, so no hook is taken.
+ */
+static bool cache_set_access_hook(cache_access_hook_fn hook)
+{
+    if (async_sim && hook) {
+        fprintf(stderr, "cache: access hook is not supported with "
+                "async=on\n");
+        return false;
+    }
+    __atomic_store_n(&access_hook, hook, __ATOMIC_RELEASE);
+    return true;
+}
 
-            // Loop through all cores' caches
-            for (int it = 0; it < cores; it++) {
-                int c_id = cache_order[it];
-                //g_mutex_lock(&l1_dcache_locks[c_id]);
-                size_t *set_order = random_indices(l1_dcaches[c_id]->num_sets, l1_dcaches[c_id]->num_sets);
+static const CacheService cache_service = {
+    .is_in_l1d = cache_is_in_l1d,
+    .is_in_l1i = cache_is_in_l1i,
+    .is_in_l2 = cache_is_in_l2,
+    .last_outcome = cache_last_outcome,
+    .set_access_hook = cache_set_access_hook,
+};
 
-                // Check each set for valid blocks
-                for (int i = 0; i < l1_dcaches[c_id]->num_sets; i++) {
-                    int s_id = set_order[i];
-                    int block_sel = get_valid_block(l1_dcaches[c_id], s_id);
-                    if (block_sel != -1) {
-                        // Found valid block, send tag and set
-                        uint64_t tag_portion = l1_dcaches[c_id]->sets[s_id].blocks[block_sel].tag & l1_dcaches[c_id]->tag_mask;
-                        uint64_t set_portion = (s_id << l1_dcaches[c_id]->blksize_shift) & l1_dcaches[c_id]->set_mask;
+/*
+ * Return a line resident in one of @caches, chosen uniformly among all
+ * resident lines of that level. All the locks of the level are taken so
+ * the counts cannot change between choosing a core and reading its line.
+ */
+static bool sample_resident(Cache **caches, GMutex *locks, uint64_t *paddr)
+{
+    uint64_t total = 0, addr = 0;
+    uint32_t r;
+    bool found = false;
+    int i;
 
-                        sprintf(ret, "0x%llx", tag_portion | set_portion);
-                        free(set_order);
-                        free(cache_order);
-                        return ret;
-                    }
-                }
-                free(set_order);
-                //g_mutex_lock(&l1_dcache_locks[c_id]);
-            }
+    for (i = 0; i < cores; i++) {
+        g_mutex_lock(&locks[i]);
+        total += caches[i]->n_resident;
+    }
 
-            free(cache_order);
-            sprintf(ret, "no valid block found");
-        } else if (g_strcmp0(command, "get_l1i_addr") == 0) {
-            size_t *cache_order = random_indices(cores, cores);
-
-            for (int it = 0; it < cores; it++) {
-                int c_id = cache_order[it];
-                size_t *set_order = random_indices(l1_icaches[c_id]->num_sets, l1_icaches[c_id]->num_sets);
-
-                for (int i = 0; i < l1_icaches[c_id]->num_sets; i++) {
-                    int s_id = set_order[i];
-                    int block_sel = get_valid_block(l1_icaches[c_id], s_id);
-                    if (block_sel != -1) {
-                        uint64_t tag_portion = l1_icaches[c_id]->sets[s_id].blocks[block_sel].tag & l1_icaches[c_id]->tag_mask;
-                        uint64_t set_portion = (s_id << l1_icaches[c_id]->blksize_shift) & l1_icaches[c_id]->set_mask;
-
-                        sprintf(ret, "0x%llx", tag_portion | set_portion);
-                        free(set_order);
-                        free(cache_order);
-                        return ret;
-                    }
-                }
-                free(set_order);
+    if (total) {
+        r = g_rand_int_range(sample_rng, 0, MIN(total, G_MAXINT32));
+        for (i = 0; i < cores; i++) {
+            if (r < caches[i]->n_resident) {
+                found = resident_sample(caches[i], r, &addr);
+                break;
             }
+            r -= caches[i]->n_resident;
+        }
+    }
 
-            free(cache_order);
-            sprintf(ret, "no valid block found");
-        } else if (g_strcmp0(command, "get_l2_addr") == 0) {
-            if (!use_l2) {
-                sprintf(ret, "not using L2 cache");
-            } else {
-                size_t *cache_order = random_indices(cores, cores);
-
-                // Loop through all cores' caches
-                for (int it = 0; it < cores; it++) {
-                    int c_id = cache_order[it];
-                    //g_mutex_lock(&l2_ucache_locks[c_id]);
-                    size_t *set_order = random_indices(l2_ucaches[c_id]->num_sets, l2_ucaches[c_id]->num_sets);
-
-                    // Check each set for valid blocks
-                    for (int i = 0; i < l2_ucaches[c_id]->num_sets; i++) {
-                        int s_id = set_order[i];
-                        int block_sel = get_valid_block(l2_ucaches[c_id], s_id);
-                        if (block_sel != -1) {
-                            // Found valid block, send tag and set
-                            uint64_t tag_portion = l2_ucaches[c_id]->sets[s_id].blocks[block_sel].tag & l2_ucaches[c_id]->tag_mask;
-                            uint64_t set_portion = (s_id << l2_ucaches[c_id]->blksize_shift) & l2_ucaches[c_id]->set_mask;
-
-                            sprintf(ret, "0x%llx", tag_portion | set_portion);
-                            free(set_order);
-                            free(cache_order);
-                            return ret;
-                        }
-                    }
-                    free(set_order);
-                    //g_mutex_lock(&l2_ucache_locks[c_id]);
-                }
+    for (i = 0; i < cores; i++) {
+        g_mutex_unlock(&locks[i]);
+    }
 
-                free(cache_order);
-                sprintf(ret, "no valid block found");
-            }
-        } else if (g_strcmp0(command, "get_mem_addr") == 0) {
-            size_t *addr_list = random_indices(max_effective_addr, 16);
-
-            for (int addr_it = 0; addr_it < 16; addr_it++) {
-                size_t test_addr = addr_list[addr_it];
-
-                // Loop through all cores' caches
-                for (int it = 0; it < cores; it++) {
-                    //g_mutex_lock(&l1_dcache_locks[it]);
-
-                    // Check if in caches
-                    if(in_cache(l1_dcaches[it], test_addr) == -1 && in_cache(l1_icaches[it], test_addr) == -1) {
-                        for (int i = 0; i < cores; i++) {
-                            //g_mutex_lock(&l2_ucache_locks[i]);
-                            if (use_l2) {
-                                if (in_cache(l2_ucaches[i], test_addr) == -1) {
-                                    sprintf(ret, "0x%lx", test_addr);
-                                    free(addr_list);
-                                    return ret;
-                                }
-                            } else {
-                                sprintf(ret, "0x%lx", test_addr);
-                                free(addr_list);
-                                return ret;
-                            }
-                            //g_mutex_lock(&l2_ucache_locks[i]);
-                        }
-                    }
-                    //g_mutex_unlock(&l1_dcache_locks[it]);
-                }
-            }
-            free(addr_list);
+    *paddr = addr;
+    return found;
+}
 
-            sprintf(ret, "no valid block found");
-        } else {
-            sprintf(ret, "unknown command");
+/*
+ * Return a random block-aligned address up to the highest one accessed so
+ * far that is not held by any cache.
+ */
+static bool sample_uncached(uint64_t *paddr)
+{
+    int blksize_shift = l1_dcaches[0]->blksize_shift;
+    uint64_t max_blk = __atomic_load_n(&max_effective_addr, __ATOMIC_RELAXED)
+                       >> blksize_shift;
+
+    for (int attempt = 0; max_blk && attempt < 16; attempt++) {
+        uint64_t addr = ((uint64_t)g_rand_int(sample_rng) << 32 |
+                         g_rand_int(sample_rng)) % (max_blk + 1);
+        bool cached = false;
+
+        addr <<= blksize_shift;
+        for (int i = 0; i < cores && !cached; i++) {
+            cached = cache_is_in_l1d(addr, i) || cache_is_in_l1i(addr, i) ||
+                     cache_is_in_l2(addr, i);
         }
+        if (!cached) {
+            *paddr = addr;
+            return true;
+        }
+    }
 
-        return ret;
+    return false;
+}
+
+/*
+ * plugin-command handler: each command samples an address and replies
+ * with it as a JSON string in hex, e.g. "0x80001040".
+ */
+static bool plugin_qmp_cmd(qemu_plugin_id_t id, const char *command,
+                           const char *arguments, char **reply,
+                           void *userdata)
+{
+    uint64_t addr;
+    bool found;
+
+    if (g_strcmp0(command, "get_l1_addr") == 0) {
+        found = sample_resident(l1_dcaches, l1_dcache_locks, &addr);
+    } else if (g_strcmp0(command, "get_l1i_addr") == 0) {
+        found = sample_resident(l1_icaches, l1_icache_locks, &addr);
+    } else if (g_strcmp0(command, "get_l2_addr") == 0) {
+        if (!use_l2) {
+            *reply = g_strdup("not using L2 cache");
+            return false;
+        }
+        found = sample_resident(l2_ucaches, l2_ucache_locks, &addr);
+    } else if (g_strcmp0(command, "get_mem_addr") == 0) {
+        found = sample_uncached(&addr);
     } else {
-        return NULL;
+        *reply = g_strdup("unknown command");
+        return false;
+    }
+
+    if (!found) {
+        *reply = g_strdup("no valid block found");
+        return false;
     }
+    /* a JSON string, which plugin_run prints as is, like it used to */
+    *reply = g_strdup_printf("\"0x%" PRIx64 "\"", addr);
+    return true;
 }
 
 QEMU_PLUGIN_EXPORT
@@ -1007,6 +2301,62 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         } else if (g_strcmp0(tokens[0], "l2assoc") == 0) {
             use_l2 = true;
             l2_assoc = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "dprefetch") == 0) {
+            if (!parse_prefetch(tokens[1], &l1_dprefetch)) {
+                fprintf(stderr, "invalid prefetcher: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "iprefetch") == 0) {
+            if (!parse_prefetch(tokens[1], &l1_iprefetch)) {
+                fprintf(stderr, "invalid prefetcher: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "l2prefetch") == 0) {
+            if (!parse_prefetch(tokens[1], &l2_prefetch)) {
+                fprintf(stderr, "invalid prefetcher: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "prefetch_degree") == 0) {
+            prefetch_degree = STRTOLL(tokens[1]);
+            if (prefetch_degree < 1 || prefetch_degree > PF_MAX_DEGREE) {
+                fprintf(stderr, "prefetch_degree must be between 1 and %d\n",
+                        PF_MAX_DEGREE);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "sample_period") == 0) {
+            if (STRTOLL(tokens[1]) <= 0) {
+                fprintf(stderr, "sample_period must be positive\n");
+                return -1;
+            }
+            sample_period = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "sample_window") == 0) {
+            if (STRTOLL(tokens[1]) <= 0) {
+                fprintf(stderr, "sample_window must be positive\n");
+                return -1;
+            }
+            sample_window = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "mrc_rate") == 0) {
+            mrc_rate = g_ascii_strtod(tokens[1], NULL);
+            if (mrc_rate <= 0 || mrc_rate > 1) {
+                fprintf(stderr, "mrc_rate must be in (0, 1]: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "async") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &async_sim)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "sim_threads") == 0) {
+            n_sim_threads = STRTOLL(tokens[1]);
+            if (n_sim_threads < 1) {
+                fprintf(stderr, "sim_threads must be at least 1\n");
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "vmstate") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &save_vmstate)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "l2") == 0) {
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &use_l2)) {
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
@@ -1029,7 +2379,22 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         }
     }
 
+    if (sample_period) {
+        if (!sample_window) {
+            sample_window = MIN(1000, sample_period / 2);
+        }
+        if (!sample_window || sample_window >= sample_period) {
+            fprintf(stderr, "sample_window must be non-zero and smaller than "
+                    "sample_period\n");
+            return -1;
+        }
+    } else if (sample_window) {
+        fprintf(stderr, "sample_window requires sample_period\n");
+        return -1;
+    }
+
     policy_init();
+    sample_rng = g_rand_new();
 
     l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize);
     if (!l1_dcaches) {
@@ -1055,15 +2420,42 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
+    if (mrc_rate) {
+        mrc_threshold = MAX(mrc_rate * MRC_HASH_RANGE, 1);
+        mrc_states = g_new0(MrcState, cores);
+        for (i = 0; i < cores; i++) {
+            mrc_states[i].last_access = g_hash_table_new(NULL, NULL);
+            mrc_states[i].stack = g_sequence_new(NULL);
+            mrc_states[i].hist = g_array_new(false, true, sizeof(uint64_t));
+        }
+    }
+
     l1_dcache_locks = g_new0(GMutex, cores);
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    l1_dpf = g_new0(Prefetcher, cores);
+    l1_ipf = g_new0(Prefetcher, cores);
+    l2_pf = use_l2 ? g_new0(Prefetcher, cores) : NULL;
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
-    qemu_plugin_register_monitor_cmd_cb(id, plugin_monitor_cmd);
+    qemu_plugin_register_qmp_cmd_cb(id, "cache", plugin_qmp_cmd, NULL, NULL);
+    qemu_plugin_register_service(id, CACHE_SERVICE_NAME,
+                                 CACHE_SERVICE_VERSION, &cache_service);
+
+    if (save_vmstate &&
+        !qemu_plugin_register_vmstate(id, "cache", CACHE_VMSTATE_VERSION,
+                                      cache_vmstate_save, cache_vmstate_load,
+                                      NULL)) {
+        fprintf(stderr, "cache: vmstate is only supported in system "
+                "emulation\n");
+        return -1;
+    }
 
-    miss_ht = g_hash_table_new_full(NULL, g_direct_equal, NULL, insn_free);
+    if (async_sim) {
+        async_start();
+    }
 
     return 0;
 }
@@ -0,0 +1,64 @@
+/*
+ * Interface exported by the cache modelling plugin to other plugins.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+
+#ifndef CONTRIB_PLUGINS_CACHE_H
+#define CONTRIB_PLUGINS_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Innermost level of the hierarchy that held the line before the access */
+typedef enum {
+    CACHE_HIT_L1,
+    CACHE_HIT_L2,
+    CACHE_HIT_MEM,
+} CacheHitLevel;
+
+/*
+ * CacheAccessOutcome describes a single simulated access. @set and @way
+ * locate the line in the level given by @level, and are -1 when the access
+ * went to memory. @addr is the address the model was indexed with (physical
+ * in system mode), @vaddr the guest virtual address of the access.
+ */
+typedef struct {
+    uint64_t vaddr;
+    uint64_t addr;
+    CacheHitLevel level;
+    int set;
+    int way;
+    bool insn;
+} CacheAccessOutcome;
+
+/*
+ * Called by the cache plugin after each simulated access, from the vCPU
+ * thread that performed it and with no cache lock held.
+ */
+typedef void (*cache_access_hook_fn)(unsigned int vcpu_index,
+                                     const CacheAccessOutcome *outcome);
+
+/*
+ * Service published by the cache plugin, see qemu_plugin_lookup_service().
+ * New members are only ever appended, bumping CACHE_SERVICE_VERSION.
+ */
+#define CACHE_SERVICE_NAME "cache"
+#define CACHE_SERVICE_VERSION 1
+
+typedef struct {
+    /* Check whether an address resides in a given cache level */
+    bool (*is_in_l1d)(uint64_t addr, int core_idx);
+    bool (*is_in_l1i)(uint64_t addr, int core_idx);
+    bool (*is_in_l2)(uint64_t addr, int core_idx);
+    /* Outcome of the last access simulated on the calling vCPU thread */
+    const CacheAccessOutcome *(*last_outcome)(void);
+    /*
+     * Install the single access hook, NULL removes it. Returns false if
+     * the hook cannot be called in the current configuration.
+     */
+    bool (*set_access_hook)(cache_access_hook_fn hook);
+} CacheService;
+
+#endif /* CONTRIB_PLUGINS_CACHE_H */
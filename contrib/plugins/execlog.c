@@ -7,6 +7,7 @@
  *   See the COPYING file in the top-level directory.
  */
 #include <glib.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,20 @@ static GRWLock expand_array_lock;
 static GPtrArray *imatches;
 static GArray *amatches;
 
+/* Registers to track, as glob patterns, and their state on each vCPU */
+typedef struct {
+    struct qemu_plugin_register *handle;
+    const char *name;
+    GByteArray *last;
+    GByteArray *new;
+} Register;
+
+static GPtrArray *rmatches;
+static GPtrArray *cpu_regs;
+
+/* Append the loaded or stored value to memory accesses */
+static bool log_value;
+
 /*
  * Expand last_exec array.
  *
@@ -36,10 +51,38 @@ static void expand_last_exec(int cpu_index)
     while (cpu_index >= last_exec->len) {
         GString *s = g_string_new(NULL);
         g_ptr_array_add(last_exec, s);
+        g_ptr_array_add(cpu_regs, NULL);
     }
     g_rw_lock_writer_unlock(&expand_array_lock);
 }
 
+/* Append the value that was loaded or stored */
+static void log_mem_value(GString *s, qemu_plugin_meminfo_t info)
+{
+    qemu_plugin_mem_value value = qemu_plugin_mem_get_value(info);
+
+    switch (value.type) {
+    case QEMU_PLUGIN_MEM_VALUE_U8:
+        g_string_append_printf(s, ", 0x%02"PRIx8, value.data.u8);
+        break;
+    case QEMU_PLUGIN_MEM_VALUE_U16:
+        g_string_append_printf(s, ", 0x%04"PRIx16, value.data.u16);
+        break;
+    case QEMU_PLUGIN_MEM_VALUE_U32:
+        g_string_append_printf(s, ", 0x%08"PRIx32, value.data.u32);
+        break;
+    case QEMU_PLUGIN_MEM_VALUE_U64:
+        g_string_append_printf(s, ", 0x%016"PRIx64, value.data.u64);
+        break;
+    case QEMU_PLUGIN_MEM_VALUE_U128:
+        g_string_append_printf(s, ", 0x%016"PRIx64"%016"PRIx64,
+                               value.data.u128.high, value.data.u128.low);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 /**
  * Add memory read or write information to current instruction log
  */
@@ -70,6 +113,67 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
     } else {
         g_string_append_printf(s, ", 0x%08"PRIx64, vaddr);
     }
+
+    if (log_value) {
+        log_mem_value(s, info);
+    }
+}
+
+/*
+ * Find the registers matching the reg= patterns. This has to run on the
+ * vCPU itself as the register list comes from its gdbstub description.
+ */
+static GPtrArray *registers_init(void)
+{
+    g_autoptr(GArray) reg_list = qemu_plugin_get_registers();
+    GPtrArray *regs = g_ptr_array_new();
+
+    for (int r = 0; reg_list && r < reg_list->len; r++) {
+        qemu_plugin_reg_descriptor *rd =
+            &g_array_index(reg_list, qemu_plugin_reg_descriptor, r);
+
+        for (int p = 0; p < rmatches->len; p++) {
+            if (g_pattern_match_simple(g_ptr_array_index(rmatches, p),
+                                       rd->name)) {
+                Register *reg = g_new0(Register, 1);
+                reg->handle = rd->handle;
+                reg->name = rd->name;
+                reg->last = g_byte_array_new();
+                reg->new = g_byte_array_new();
+                qemu_plugin_read_register(reg->handle, reg->last);
+                g_ptr_array_add(regs, reg);
+                break;
+            }
+        }
+    }
+    return regs;
+}
+
+/*
+ * Append the registers that changed since the last instruction to its
+ * log line. Values are printed most significant byte first, assuming a
+ * little-endian target.
+ */
+static void log_registers(GString *s, GPtrArray *regs)
+{
+    for (int r = 0; r < regs->len; r++) {
+        Register *reg = g_ptr_array_index(regs, r);
+        GByteArray *tmp;
+
+        g_byte_array_set_size(reg->new, 0);
+        qemu_plugin_read_register(reg->handle, reg->new);
+        if (reg->new->len == reg->last->len &&
+            memcmp(reg->new->data, reg->last->data, reg->new->len) == 0) {
+            continue;
+        }
+        g_string_append_printf(s, ", %s -> 0x", reg->name);
+        for (int i = reg->new->len - 1; i >= 0; i--) {
+            g_string_append_printf(s, "%02x", reg->new->data[i]);
+        }
+        tmp = reg->last;
+        reg->last = reg->new;
+        reg->new = tmp;
+    }
 }
 
 /**
@@ -78,6 +182,7 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
 static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
 {
     GString *s;
+    GPtrArray *regs = NULL;
 
     /* Find or create vCPU in array */
     g_rw_lock_reader_lock(&expand_array_lock);
@@ -87,8 +192,21 @@ static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
         g_rw_lock_reader_lock(&expand_array_lock);
     }
     s = g_ptr_array_index(last_exec, cpu_index);
+    if (rmatches) {
+        regs = g_ptr_array_index(cpu_regs, cpu_index);
+    }
     g_rw_lock_reader_unlock(&expand_array_lock);
 
+    if (rmatches && !regs) {
+        regs = registers_init();
+        g_rw_lock_writer_lock(&expand_array_lock);
+        g_ptr_array_index(cpu_regs, cpu_index) = regs;
+        g_rw_lock_writer_unlock(&expand_array_lock);
+    } else if (regs && s->len) {
+        /* Registers written by the previous instruction */
+        log_registers(s, regs);
+    }
+
     /* Print previous instruction in cache */
     if (s->len) {
         qemu_plugin_outs(s->str);
@@ -167,8 +285,10 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                              QEMU_PLUGIN_MEM_RW, NULL);
 
             /* Register callback on instruction */
-            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                                   QEMU_PLUGIN_CB_NO_REGS, output);
+            qemu_plugin_register_vcpu_insn_exec_cb(
+                insn, vcpu_insn_exec,
+                rmatches ? QEMU_PLUGIN_CB_R_REGS : QEMU_PLUGIN_CB_NO_REGS,
+                output);
 
             /* reset skip */
             skip = (imatches || amatches);
@@ -202,6 +322,14 @@ static void parse_insn_match(char *match)
     g_ptr_array_add(imatches, match);
 }
 
+static void parse_reg_match(char *match)
+{
+    if (!rmatches) {
+        rmatches = g_ptr_array_new();
+    }
+    g_ptr_array_add(rmatches, match);
+}
+
 static void parse_vaddr_match(char *match)
 {
     uint64_t v = g_ascii_strtoull(match, NULL, 16);
@@ -212,6 +340,19 @@ static void parse_vaddr_match(char *match)
     g_array_append_val(amatches, v);
 }
 
+/* parse a whole hexadecimal address, with or without 0x prefix */
+static bool parse_hex_addr(const char *str, uint64_t *addr)
+{
+    char *end;
+
+    if (*str == '\0') {
+        return false;
+    }
+    errno = 0;
+    *addr = g_ascii_strtoull(str, &end, 16);
+    return errno == 0 && *end == '\0';
+}
+
 /**
  * Install the plugin
  */
@@ -228,6 +369,7 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     } else {
         last_exec = g_ptr_array_new();
     }
+    cpu_regs = g_ptr_array_new();
 
     for (int i = 0; i < argc; i++) {
         char *opt = argv[i];
@@ -236,6 +378,31 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             parse_insn_match(tokens[1]);
         } else if (g_strcmp0(tokens[0], "afilter") == 0) {
             parse_vaddr_match(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "reg") == 0) {
+            parse_reg_match(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "range") == 0) {
+            g_auto(GStrv) bounds = g_strsplit(tokens[1] ? tokens[1] : "",
+                                              "-", 2);
+            uint64_t start, end;
+
+            if (!bounds[0] || !bounds[1] ||
+                !parse_hex_addr(bounds[0], &start) ||
+                !parse_hex_addr(bounds[1], &end) ||
+                !qemu_plugin_filter_add_range(id, start, end)) {
+                fprintf(stderr, "invalid range: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "symbol") == 0) {
+            if (!tokens[1] || !*tokens[1] ||
+                !qemu_plugin_filter_add_symbol(id, tokens[1])) {
+                fprintf(stderr, "invalid symbol: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "value") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &log_value)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
@@ -3,10 +3,14 @@
  *
  * Simulates radiation-induced bit flips on memory and instruction accesses.
  * Flip probability depends on cache level (L1d, L1i, L2, or main memory).
- * Requires the "cache" plugin to be loaded first.
+ * Requires the "cache" plugin to be loaded first, whose "cache" service it
+ * looks up at install time. Accesses are classified
+ * from the outcome the cache plugin reports for each simulated access, so
+ * the caches are not probed a second time.
  *
  * Data flips occur after the current access, affecting subsequent loads.
- * Instruction flips flush the TB cache to force re-translation.
+ * Instruction flips are written like any other guest store, which drops
+ * the translations of the flipped code as for self-modifying code.
  *
  * Parameters (1 in N chance per access):
  *   l1d_flip_chance, l1i_flip_chance, l2_flip_chance, mem_flip_chance
@@ -15,8 +19,6 @@
  * License: GNU GPL, version 2 or later.
  */
 
-#define _GNU_SOURCE
-#include <dlfcn.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +27,8 @@
 
 #include <qemu-plugin.h>
 
+#include "cache.h"
+
 #define STRTOLL(x) g_ascii_strtoll(x, NULL, 10)
 
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
@@ -43,11 +47,7 @@ static uint64_t total_accesses;
 static GMutex rng_lock;
 static GRand *rng;
 
-typedef bool (*cache_check_fn)(uint64_t addr, int core_idx);
-
-static cache_check_fn is_in_l1d;
-static cache_check_fn is_in_l1i;
-static cache_check_fn is_in_l2;
+static const CacheService *cache;
 
 /* Flip a random bit in the byte at vaddr. Returns true on success. */
 static bool flip_bit_at(uint64_t vaddr)
@@ -82,45 +82,41 @@ static bool should_flip(uint64_t chance)
     return result;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index,
-                            qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+/* Data fault: flip a bit at the accessed address after the access. */
+static void mem_access(const CacheAccessOutcome *outcome)
 {
-    __atomic_fetch_add(&total_accesses, 1, __ATOMIC_SEQ_CST);
-
-    struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-        return;
-    }
-    uint64_t paddr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
-
     uint64_t chance;
     uint64_t *counter;
 
-    if (is_in_l1d && is_in_l1d(paddr, vcpu_index)) {
+    __atomic_fetch_add(&total_accesses, 1, __ATOMIC_SEQ_CST);
+
+    switch (outcome->level) {
+    case CACHE_HIT_L1:
         chance = l1d_flip_chance;
         counter = &l1d_flips;
-    } else if (is_in_l2 && is_in_l2(paddr, vcpu_index)) {
+        break;
+    case CACHE_HIT_L2:
         chance = l2_flip_chance;
         counter = &l2_flips;
-    } else {
+        break;
+    default:
         chance = mem_flip_chance;
         counter = &mem_flips;
+        break;
     }
 
-    if (should_flip(chance) && flip_bit_at(vaddr)) {
+    if (should_flip(chance) && flip_bit_at(outcome->vaddr)) {
         __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
     }
 }
 
-/* Instruction fault: check L1i vs main memory, flip a bit, flush TBs. */
-static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+/* Instruction fault: check L1i vs main memory, flip a bit. */
+static void insn_exec(const CacheAccessOutcome *outcome)
 {
-    uint64_t vaddr = (uint64_t)(uintptr_t)userdata;
     uint64_t chance;
     uint64_t *counter;
 
-    if (is_in_l1i && is_in_l1i(vaddr, vcpu_index)) {
+    if (outcome->level == CACHE_HIT_L1) {
         chance = l1i_flip_chance;
         counter = &l1i_flips;
     } else {
@@ -128,29 +124,18 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
         counter = &mem_flips;
     }
 
-    if (should_flip(chance) && flip_bit_at(vaddr)) {
+    if (should_flip(chance) && flip_bit_at(outcome->vaddr)) {
         __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
-        qemu_plugin_tb_flush();
     }
 }
 
-static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+static void cache_access(unsigned int vcpu_index,
+                         const CacheAccessOutcome *outcome)
 {
-    size_t n_insns = qemu_plugin_tb_n_insns(tb);
-
-    for (size_t i = 0; i < n_insns; i++) {
-        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         QEMU_PLUGIN_MEM_RW, NULL);
-
-        if (l1i_flip_chance || mem_flip_chance) {
-            uint64_t vaddr = qemu_plugin_insn_vaddr(insn);
-            qemu_plugin_register_vcpu_insn_exec_cb(
-                insn, vcpu_insn_exec, QEMU_PLUGIN_CB_NO_REGS,
-                (void *)(uintptr_t)vaddr);
-        }
+    if (outcome->insn) {
+        insn_exec(outcome);
+    } else {
+        mem_access(outcome);
     }
 }
 
@@ -158,6 +143,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) rep = g_string_new("Fault Injection Summary:\n");
 
+    /* the cache plugin outlives us, but must not call back into this one */
+    cache->set_access_hook(NULL);
+    cache = NULL;
+
     g_string_append_printf(rep, "  Total memory accesses: %" PRIu64 "\n",
                            total_accesses);
     g_string_append_printf(rep, "  L1 data cache flips:   %" PRIu64 " (1 in %"
@@ -201,48 +190,22 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
-    /*
-     * Find libcache.so in the same directory as our own .so.
-     * Use dladdr on one of our own symbols to find our path, then replace
-     * the filename with libcache.so.
-     */
-    Dl_info self_info;
-    if (!dladdr((void *)qemu_plugin_install, &self_info)) {
-        fprintf(stderr, "fault_injection: dladdr failed: %s\n", dlerror());
-        return -1;
-    }
-
-    const char *self_path = self_info.dli_fname;
-    const char *last_slash = strrchr(self_path, '/');
-    g_autofree char *cache_path = NULL;
-    if (last_slash) {
-        cache_path = g_strdup_printf("%.*s/libcache.so",
-                                     (int)(last_slash - self_path), self_path);
-    } else {
-        cache_path = g_strdup("libcache.so");
-    }
-
-    void *cache_handle = dlopen(cache_path, RTLD_LAZY | RTLD_NOLOAD);
-    if (!cache_handle) {
+    cache = qemu_plugin_lookup_service(id, CACHE_SERVICE_NAME,
+                                       CACHE_SERVICE_VERSION, NULL);
+    if (!cache) {
         fprintf(stderr, "fault_injection: cache plugin not loaded — "
                 "load libcache.so before libfault_injection.so\n");
         return -1;
     }
 
-    is_in_l1d = dlsym(cache_handle, "cache_is_in_l1d");
-    is_in_l1i = dlsym(cache_handle, "cache_is_in_l1i");
-    is_in_l2 = dlsym(cache_handle, "cache_is_in_l2");
-
-    if (!is_in_l1d && !is_in_l1i && !is_in_l2) {
-        fprintf(stderr, "fault_injection: cache plugin has no "
-                "cache_is_in_* symbols\n");
-        dlclose(cache_handle);
+    if (!cache->set_access_hook(cache_access)) {
+        fprintf(stderr, "fault_injection: cache plugin cannot report access "
+                "outcomes\n");
         return -1;
     }
 
     rng = g_rand_new();
 
-    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
     return 0;
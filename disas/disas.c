@@ -333,3 +333,16 @@ const char *lookup_symbol(uint64_t orig_addr)
 
     return symbol;
 }
+
+bool lookup_symbol_range(const char *name, uint64_t *start, uint64_t *size)
+{
+    struct syminfo *s;
+
+    for (s = syminfos; s; s = s->next) {
+        if (s->lookup_name && s->lookup_name(s, name, start, size)) {
+            return true;
+        }
+    }
+
+    return false;
+}
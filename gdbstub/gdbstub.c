@@ -500,7 +500,111 @@ const GDBFeature *gdb_find_static_feature(const char *xmlname)
     g_assert_not_reached();
 }
 
-static int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
+/* Return the XML description of the feature @xmlname for @cpu */
+static const char *gdb_lookup_feature_xml(CPUState *cpu, const char *xmlname)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+
+    if (cc->gdb_get_dynamic_xml) {
+        const char *xml = cc->gdb_get_dynamic_xml(cpu, xmlname);
+        if (xml) {
+            return xml;
+        }
+    }
+    for (int i = 0; gdb_static_features[i].xmlname; i++) {
+        if (strcmp(gdb_static_features[i].xmlname, xmlname) == 0) {
+            return gdb_static_features[i].xml;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    GArray *regs;
+    const char *feature_name;
+    int next_reg;
+} GDBRegListParser;
+
+static void gdb_reg_list_start_element(GMarkupParseContext *context,
+                                       const gchar *element_name,
+                                       const gchar **attribute_names,
+                                       const gchar **attribute_values,
+                                       gpointer user_data, GError **error)
+{
+    GDBRegListParser *p = user_data;
+    const char *name = NULL;
+    int i;
+
+    if (strcmp(element_name, "feature") == 0) {
+        for (i = 0; attribute_names[i]; i++) {
+            if (strcmp(attribute_names[i], "name") == 0) {
+                p->feature_name = g_intern_string(attribute_values[i]);
+            }
+        }
+        return;
+    }
+    if (strcmp(element_name, "reg") != 0) {
+        return;
+    }
+
+    /* like gdb, number registers sequentially unless told otherwise */
+    for (i = 0; attribute_names[i]; i++) {
+        if (strcmp(attribute_names[i], "name") == 0) {
+            name = attribute_values[i];
+        } else if (strcmp(attribute_names[i], "regnum") == 0) {
+            p->next_reg = atoi(attribute_values[i]);
+        }
+    }
+    if (name) {
+        GDBRegDesc desc = {
+            .gdb_reg = p->next_reg,
+            .name = g_intern_string(name),
+            .feature_name = p->feature_name,
+        };
+        g_array_append_val(p->regs, desc);
+    }
+    p->next_reg++;
+}
+
+static void gdb_reg_list_parse(CPUState *cpu, GArray *regs,
+                               const char *xmlname, int base_reg)
+{
+    static const GMarkupParser parser = {
+        .start_element = gdb_reg_list_start_element,
+    };
+    GDBRegListParser p = { .regs = regs, .next_reg = base_reg };
+    const char *xml = gdb_lookup_feature_xml(cpu, xmlname);
+    GMarkupParseContext *ctx;
+
+    if (!xml) {
+        return;
+    }
+    ctx = g_markup_parse_context_new(&parser, 0, &p, NULL);
+    if (!g_markup_parse_context_parse(ctx, xml, -1, NULL)) {
+        warn_report("gdbstub: cannot parse register description %s", xmlname);
+    }
+    g_markup_parse_context_free(ctx);
+}
+
+GArray *gdb_get_register_list(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    GArray *regs = g_array_new(false, false, sizeof(GDBRegDesc));
+    GDBRegisterState *r;
+
+    if (cc->gdb_core_xml_file) {
+        gdb_reg_list_parse(cpu, regs, cc->gdb_core_xml_file, 0);
+    }
+    if (cpu->gdb_regs) {
+        for (guint i = 0; i < cpu->gdb_regs->len; i++) {
+            r = &g_array_index(cpu->gdb_regs, GDBRegisterState, i);
+            gdb_reg_list_parse(cpu, regs, r->xml, r->base_reg);
+        }
+    }
+    return regs;
+}
+
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     CPUArchState *env = cpu_env(cpu);
@@ -521,7 +625,7 @@ static int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
     return 0;
 }
 
-static int gdb_write_register(CPUState *cpu, uint8_t *mem_buf, int reg)
+int gdb_write_register(CPUState *cpu, uint8_t *mem_buf, int reg)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     CPUArchState *env = cpu_env(cpu);
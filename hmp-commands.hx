@@ -20,18 +20,22 @@ SRST
   Show the help for all commands or just for command *cmd*.
 ERST
 
+#ifdef CONFIG_PLUGIN
     {
         .name       = "plugin_run",
-        .args_type  = "plugin:s,command:s",
-        .params     = "plugin command",
+        .args_type  = "plugin:s,command:s,arguments:S?",
+        .params     = "plugin command [arguments]",
         .help       = "send a command to a QEMU plugin",
-        .cmd        = qmp_plugin_command,
+        .cmd        = hmp_plugin_run,
     },
 
 SRST
-``plugin``
-  Send a command to a QEMU plugin with support for monitor commands.
+``plugin_run`` *plugin* *command* [*arguments*]
+  Send *command* to the TCG plugin that handles commands for *plugin*.
+  The optional *arguments* are JSON text passed to the plugin. This is
+  the HMP version of the ``plugin-command`` QMP command.
 ERST
+#endif
 
     {
         .name       = "commit",
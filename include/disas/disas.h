@@ -13,14 +13,20 @@ char *plugin_disas(CPUState *cpu, uint64_t addr, size_t size);
 /* Look up symbol for debugging purpose.  Returns "" if unknown. */
 const char *lookup_symbol(uint64_t orig_addr);
 
+/* Look up the address range of function @name.  Returns false if unknown. */
+bool lookup_symbol_range(const char *name, uint64_t *start, uint64_t *size);
+
 struct syminfo;
 struct elf32_sym;
 struct elf64_sym;
 
 typedef const char *(*lookup_symbol_t)(struct syminfo *s, uint64_t orig_addr);
+typedef bool (*lookup_name_t)(struct syminfo *s, const char *name,
+                              uint64_t *start, uint64_t *size);
 
 struct syminfo {
     lookup_symbol_t lookup_symbol;
+    lookup_name_t lookup_name;
     unsigned int disas_num_syms;
     union {
       struct elf32_sym *elf32;
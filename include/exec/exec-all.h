@@ -465,6 +465,15 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
     return qatomic_read(&tb->cflags);
 }
 
+/*
+ * The cflags that take part in looking up @tb: a tier 2 retranslation
+ * replaces the TB it was promoted from under the same key.
+ */
+static inline uint32_t tb_key_cflags(const TranslationBlock *tb)
+{
+    return tb_cflags(tb) & ~CF_TIER2;
+}
+
 static inline tb_page_addr_t tb_page_addr0(const TranslationBlock *tb)
 {
 #ifdef CONFIG_USER_ONLY
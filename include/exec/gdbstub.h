@@ -102,6 +102,49 @@ void gdb_feature_builder_end(const GDBFeatureBuilder *builder);
  */
 const GDBFeature *gdb_find_static_feature(const char *xmlname);
 
+/**
+ * typedef GDBRegDesc - a register as described to gdb
+ * @gdb_reg: register number, as passed to gdb_read_register()
+ * @name: register name, interned
+ * @feature_name: name of the feature the register belongs to, interned
+ */
+typedef struct {
+    int gdb_reg;
+    const char *name;
+    const char *feature_name;
+} GDBRegDesc;
+
+/**
+ * gdb_get_register_list() - list the registers gdb can see on @cpu
+ * @cpu: the CPU to query
+ *
+ * The list is derived from the same XML descriptions the gdbstub sends
+ * to gdb, including the coprocessor and dynamically generated ones.
+ *
+ * Return: a GArray of GDBRegDesc, to be freed by the caller.
+ */
+GArray *gdb_get_register_list(CPUState *cpu);
+
+/**
+ * gdb_read_register() - read a register as gdb would
+ * @cpu: the CPU to read from
+ * @buf: byte array the value is appended to, in target byte order
+ * @reg: register number, see GDBRegDesc
+ *
+ * Return: the size of the register in bytes, 0 if @reg is unknown.
+ */
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg);
+
+/**
+ * gdb_write_register() - write a register as gdb would
+ * @cpu: the CPU to write to
+ * @mem_buf: the new value, in target byte order
+ * @reg: register number, see GDBRegDesc
+ *
+ * Return: the size of the register in bytes, 0 if @reg is unknown.
+ */
+int gdb_write_register(CPUState *cpu, uint8_t *mem_buf, int reg);
+
 void gdb_set_stop_cpu(CPUState *cpu);
 
 /* in gdbstub-xml.c, generated by scripts/feature_to_c.py */
@@ -25,6 +25,7 @@ void plugin_gen_insn_start(CPUState *cpu, const struct DisasContextBase *db);
 void plugin_gen_insn_end(void);
 
 void plugin_gen_disable_mem_helpers(void);
+void plugin_gen_empty_mem_value(TCGv_i64 low, TCGv_i64 high, uint32_t info);
 void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info);
 
 #else /* !CONFIG_PLUGIN */
@@ -48,6 +49,10 @@ static inline void plugin_gen_tb_end(CPUState *cpu, size_t num_insns)
 static inline void plugin_gen_disable_mem_helpers(void)
 { }
 
+static inline
+void plugin_gen_empty_mem_value(TCGv_i64 low, TCGv_i64 high, uint32_t info)
+{ }
+
 static inline void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
 { }
 
@@ -77,6 +77,7 @@ struct TranslationBlock {
 #define CF_PARALLEL      0x00008000 /* Generate code for a parallel context */
 #define CF_NOIRQ         0x00010000 /* Generate an uninterruptible TB */
 #define CF_PCREL         0x00020000 /* Opcodes in TB are PC-relative */
+#define CF_TIER2         0x00040000 /* Hot TB retranslated; not in the key */
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -140,6 +141,19 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Guest PCs of the direct jumps out of this TB, or -1.  Recorded at
+     * translation time so that idle vCPUs can translate the likely
+     * successors ahead of execution.
+     */
+    vaddr succ_pc[2];
+
+    /*
+     * Executions counted towards promotion to tier 2, see CF_TIER2.
+     * Approximate under MTTCG, see gen_tb_count().
+     */
+    uint32_t exec_count;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
@@ -536,6 +536,11 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    /* value of the memory access being reported to plugins */
+    uint64_t plugin_mem_value_low;
+    uint64_t plugin_mem_value_high;
+    /* enum qemu_plugin_cb_flags of the plugin callback being run */
+    int plugin_cb_flags;
 #endif
 
     /* TODO Move common fields from CPUArchState here. */
@@ -544,6 +549,8 @@ struct CPUState {
     uint32_t tcg_cflags;
     uint32_t halted;
     int32_t exception_index;
+    /* see cpu_interrupt_delivered() */
+    int32_t delivered_interrupt;
 
     AccelCPUState *accel;
     /* shared by kvm and hvf */
@@ -1119,6 +1126,20 @@ void cpu_watchpoint_remove_by_ref(CPUState *cpu, CPUWatchpoint *watchpoint);
 void cpu_watchpoint_remove_all(CPUState *cpu, int mask);
 #endif
 
+/**
+ * cpu_interrupt_delivered() - record the interrupt being taken
+ * @cpu: The CPU taking the interrupt
+ * @cause: target-specific interrupt number, in @exception_index format
+ *
+ * Called from the cpu_exec_interrupt hook of targets whose interrupt
+ * delivery resets @exception_index, so that the cause can still be
+ * reported to plugins once the hook returns.
+ */
+static inline void cpu_interrupt_delivered(CPUState *cpu, int32_t cause)
+{
+    cpu->delivered_interrupt = cause;
+}
+
 /**
  * cpu_plugin_mem_cbs_enabled() - are plugin memory callbacks enabled?
  * @cs: CPUState pointer
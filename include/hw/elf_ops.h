@@ -95,6 +95,30 @@ static const char *glue(lookup_symbol, SZ)(struct syminfo *s,
     return "";
 }
 
+static bool glue(lookup_name, SZ)(struct syminfo *s, const char *name,
+                                  uint64_t *start, uint64_t *size)
+{
+    struct elf_sym *syms = glue(s->disas_symtab.elf, SZ);
+    unsigned int i;
+
+    /* the table is sorted by address, names need a linear scan */
+    for (i = 0; i < s->disas_num_syms; i++) {
+        int type = ELF_ST_TYPE(syms[i].st_info);
+
+        /* only code and data have an address range worth filtering on */
+        if (type != STT_FUNC && type != STT_OBJECT) {
+            continue;
+        }
+        if (strcmp(s->disas_strtab + syms[i].st_name, name) == 0) {
+            *start = syms[i].st_value;
+            *size = syms[i].st_size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static int glue(symcmp, SZ)(const void *s0, const void *s1)
 {
     struct elf_sym *sym0 = (struct elf_sym *)s0;
@@ -191,6 +215,7 @@ static void glue(load_symbols, SZ)(struct elfhdr *ehdr, int fd, int must_swab,
     /* Commit */
     s = g_malloc0(sizeof(*s));
     s->lookup_symbol = glue(lookup_symbol, SZ);
+    s->lookup_name = glue(lookup_name, SZ);
     glue(s->disas_symtab.elf, SZ) = g_steal_pointer(&syms);
     s->disas_num_syms = nsyms;
     s->disas_strtab = g_steal_pointer(&str);
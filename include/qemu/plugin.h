@@ -63,6 +63,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_vcpu_discon_cb_t     vcpu_discon;
     void *generic;
 };
 
@@ -75,9 +76,56 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
+    PLUGIN_CB_TRACE,
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/*
+ * Scoreboard entries are padded to this size so that vCPUs updating
+ * their own slot do not bounce cache lines between each other.
+ */
+#define PLUGIN_SCOREBOARD_ALIGN 64
+
+/* Internal representation of a scoreboard */
+struct qemu_plugin_scoreboard {
+    /* one slot of @stride bytes per vCPU, see scoreboard_alloc_size */
+    void *data;
+    size_t element_size;
+    size_t stride;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+/*
+ * Translated code reserves room for the traced accesses of a whole
+ * instruction before executing it, so a buffer must hold at least that
+ * many records.
+ */
+#define PLUGIN_MEM_TRACE_MIN_RECORDS 1024
+
+/* Internal representation of a memory trace */
+struct qemu_plugin_mem_trace {
+    /* one struct qemu_plugin_mem_trace_cursor per vCPU */
+    struct qemu_plugin_scoreboard *cursors;
+    /* plugin that owns the trace, which is freed when it is uninstalled */
+    qemu_plugin_id_t id;
+    size_t n_records;
+    qemu_plugin_vcpu_mem_trace_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_trace) entry;
+};
+
+/*
+ * Per-vCPU buffer of a memory trace. Translated code appends records at
+ * @pos. The buffer is only allocated by the first flush, so a vCPU that
+ * never ran a traced access has all three pointers NULL.
+ */
+struct qemu_plugin_mem_trace_cursor {
+    qemu_plugin_mem_record *pos;
+    qemu_plugin_mem_record *start;
+    qemu_plugin_mem_record *end;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -87,14 +135,24 @@ struct qemu_plugin_dyn_cb {
     union qemu_plugin_cb_sig f;
     void *userp;
     enum plugin_dyn_cb_subtype type;
-    /* @rw applies to mem callbacks only (both regular and inline) */
+    /* @rw applies to mem callbacks only (regular, inline and trace) */
     enum qemu_plugin_mem_rw rw;
+    /* @flags applies to regular and conditional exec callbacks only */
+    enum qemu_plugin_cb_flags flags;
     /* fields specific to each dyn_cb type go here */
     union {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* if @entry.score is set, the op targets it instead of userp */
+            qemu_plugin_u64 entry;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t add;
+            uint64_t imm;
+        } cond;
     };
 };
 
@@ -148,6 +206,8 @@ struct qemu_plugin_tb {
     void *haddr1;
     void *haddr2;
     bool mem_only;
+    /* MMU index used to fetch the TB's code, for translation filters */
+    int mmu_idx;
 
     /* if set, the TB calls helpers that might access guest memory */
     bool mem_helper;
@@ -188,7 +248,17 @@ struct qemu_plugin_insn *qemu_plugin_tb_insn_get(struct qemu_plugin_tb *tb,
 
 void qemu_plugin_vcpu_init_hook(CPUState *cpu);
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu);
+void qemu_plugin_vcpu_mem_trace_flush(CPUState *cpu);
 void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb);
+
+/**
+ * qemu_plugin_tb_filter(): check the translation filters of the plugins
+ * @pc: address of the first instruction of the TB
+ * @mmu_idx: MMU index used to fetch the TB's code
+ *
+ * Returns true if at least one plugin wants to instrument the TB.
+ */
+bool qemu_plugin_tb_filter(uint64_t pc, int mmu_idx);
 void qemu_plugin_vcpu_idle_cb(CPUState *cpu);
 void qemu_plugin_vcpu_resume_cb(CPUState *cpu);
 void
@@ -196,8 +266,14 @@ qemu_plugin_vcpu_syscall(CPUState *cpu, int64_t num, uint64_t a1,
                          uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5,
                          uint64_t a6, uint64_t a7, uint64_t a8);
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
+void qemu_plugin_vcpu_discon_cb(CPUState *cpu,
+                                enum qemu_plugin_discon_type type,
+                                uint64_t cause, uint64_t from_pc,
+                                uint64_t to_pc);
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
+                             uint64_t value_low,
+                             uint64_t value_high,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
 void qemu_plugin_flush_cb(void);
@@ -209,6 +285,9 @@ char *qemu_plugin_monitor_cmd_cb(const char *name,
 
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
 
+void plugin_mem_trace_flush(struct qemu_plugin_mem_trace *trace,
+                            unsigned int cpu_index);
+
 static inline void qemu_plugin_disable_mem_helpers(CPUState *cpu)
 {
     cpu->plugin_mem_cbs = NULL;
@@ -264,6 +343,14 @@ static inline void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 static inline void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 { }
 
+static inline void qemu_plugin_vcpu_mem_trace_flush(CPUState *cpu)
+{ }
+
+static inline bool qemu_plugin_tb_filter(uint64_t pc, int mmu_idx)
+{
+    return false;
+}
+
 static inline void qemu_plugin_tb_trans_cb(CPUState *cpu,
                                            struct qemu_plugin_tb *tb)
 { }
@@ -284,7 +371,16 @@ static inline
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
 { }
 
+static inline
+void qemu_plugin_vcpu_discon_cb(CPUState *cpu,
+                                enum qemu_plugin_discon_type type,
+                                uint64_t cause, uint64_t from_pc,
+                                uint64_t to_pc)
+{ }
+
 static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
+                                           uint64_t value_low,
+                                           uint64_t value_high,
                                            MemOpIdx oi,
                                            enum qemu_plugin_mem_rw rw)
 { }
@@ -11,6 +11,7 @@
 #ifndef QEMU_QEMU_PLUGIN_H
 #define QEMU_QEMU_PLUGIN_H
 
+#include <glib.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -228,6 +229,19 @@ void qemu_plugin_register_vcpu_resume_cb(qemu_plugin_id_t id,
 struct qemu_plugin_tb;
 /** struct qemu_plugin_insn - Opaque handle for a translated instruction */
 struct qemu_plugin_insn;
+/** struct qemu_plugin_scoreboard - Opaque handle for a per-vCPU storage */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
+ *
+ * This field allows to access a specific uint64_t member in one given entry,
+ * located at a specified offset. Inline operations expect this as entry.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
 
 /**
  * enum qemu_plugin_cb_flags - type of callback
@@ -236,8 +250,10 @@ struct qemu_plugin_insn;
  * @QEMU_PLUGIN_CB_R_REGS: callback reads the CPU's regs
  * @QEMU_PLUGIN_CB_RW_REGS: callback reads and writes the CPU's regs
  *
- * Note: currently unused, plugins cannot read or change system
- * register state.
+ * Callbacks that declare R_REGS or RW_REGS may use
+ * qemu_plugin_read_register(), and RW_REGS also
+ * qemu_plugin_write_register(). Only regular and conditional execution
+ * callbacks honour the flags; memory callbacks are always NO_REGS.
  */
 enum qemu_plugin_cb_flags {
     QEMU_PLUGIN_CB_NO_REGS,
@@ -259,6 +275,66 @@ enum qemu_plugin_mem_rw {
 typedef void (*qemu_plugin_vcpu_tb_trans_cb_t)(qemu_plugin_id_t id,
                                                struct qemu_plugin_tb *tb);
 
+/*
+ * Translation filters
+ *
+ * By default the translation callback of a plugin sees every TB. The
+ * following functions, which can only be called from
+ * qemu_plugin_install(), restrict it to the TBs starting in the given
+ * ranges and fetched with the given MMU indexes. TBs that no plugin
+ * wants are translated without any instrumentation, so they run at the
+ * speed of uninstrumented code.
+ */
+
+/**
+ * qemu_plugin_filter_add_range() - instrument TBs starting in a range
+ * @id: plugin ID
+ * @start: first guest virtual address of the range
+ * @end: first guest virtual address past the range
+ *
+ * Can be called several times, a TB is instrumented if it starts in any
+ * of the ranges given with this function or
+ * qemu_plugin_filter_add_symbol().
+ *
+ * Returns: true on success, false if the range is empty or the function
+ * is not called from qemu_plugin_install()
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_filter_add_range(qemu_plugin_id_t id,
+                                  uint64_t start, uint64_t end);
+
+/**
+ * qemu_plugin_filter_add_symbol() - instrument TBs starting in a function
+ * @id: plugin ID
+ * @name: name of a function symbol of the guest image
+ *
+ * Adds the range covered by @name. Symbols come from the ELF images QEMU
+ * loads itself (the user-mode binary, or e.g. -kernel in system
+ * emulation) and are looked up when the first TB is translated. Only
+ * function and data object symbols are considered. A missing symbol is
+ * reported and matches nothing.
+ *
+ * Returns: true on success, false if @name is NULL or empty or the
+ * function is not called from qemu_plugin_install()
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_filter_add_symbol(qemu_plugin_id_t id, const char *name);
+
+/**
+ * qemu_plugin_filter_mmu_idx() - instrument TBs of some MMU indexes
+ * @id: plugin ID
+ * @mask: bit N set to instrument code fetched with MMU index N
+ *
+ * MMU indexes are target specific, but usually map to privilege levels:
+ * on RISC-V for instance 0 is user mode, 1 supervisor mode and 3 machine
+ * mode. A zero @mask instruments every MMU index.
+ *
+ * Returns: true on success, false if the function is not called from
+ * qemu_plugin_install()
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_filter_mmu_idx(qemu_plugin_id_t id, uint64_t mask);
+
 /**
  * qemu_plugin_register_vcpu_tb_trans_cb() - register a translate cb
  * @id: plugin ID
@@ -321,6 +397,22 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry of a scoreboard to apply the op to
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op is applied
+ * to @entry in the slot of the vCPU executing the block. vCPUs never
+ * share a slot, so the result is exact even under MTTCG.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -351,6 +443,101 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry of a scoreboard to apply the op to
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the op is
+ * applied to @entry in the slot of the vCPU executing the instruction.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
+/**
+ * enum qemu_plugin_cond - condition guarding a conditional callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: never call the callback
+ * @QEMU_PLUGIN_COND_ALWAYS: always call the callback
+ * @QEMU_PLUGIN_COND_EQ: counter == immediate
+ * @QEMU_PLUGIN_COND_NE: counter != immediate
+ * @QEMU_PLUGIN_COND_LT: counter < immediate
+ * @QEMU_PLUGIN_COND_LE: counter <= immediate
+ * @QEMU_PLUGIN_COND_GT: counter > immediate
+ * @QEMU_PLUGIN_COND_GE: counter >= immediate
+ *
+ * Comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
+};
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - conditional tb execution cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition under which @cb is called
+ * @entry: scoreboard entry holding the per-vCPU counter
+ * @add: value added to the vCPU's counter before the comparison
+ * @imm: immediate the counter is compared against
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * Every time the translated unit executes, @add is added to the
+ * vCPU's @entry and @cb is called only if the updated counter
+ * satisfies @cond against @imm. Both the update and the comparison are
+ * generated inline, so executions that do not meet the condition never
+ * leave the translated code. This makes it cheap to e.g. sample every
+ * Nth execution of a block.
+ *
+ * As with inline ops the update is not atomic, but each vCPU only ever
+ * touches its own entry, and entries of different vCPUs do not share a
+ * cache line. The scoreboard must not be freed while the callback is
+ * installed.
+ *
+ * Conditional callbacks run after the inline ops registered for the
+ * same event.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t add, uint64_t imm,
+                                               void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn exec cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition under which @cb is called
+ * @entry: scoreboard entry holding the per-vCPU counter
+ * @add: value added to the vCPU's counter before the comparison
+ * @imm: immediate the counter is compared against
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * Same as qemu_plugin_register_vcpu_tb_exec_cond_cb(), but for every
+ * execution of an instruction.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn, qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags, enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry, uint64_t add, uint64_t imm, void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -434,6 +621,37 @@ typedef uint32_t qemu_plugin_meminfo_t;
 /** struct qemu_plugin_hwaddr - opaque hw address handle */
 struct qemu_plugin_hwaddr;
 
+/**
+ * enum qemu_plugin_mem_value_type - size of a memory access value
+ */
+enum qemu_plugin_mem_value_type {
+    QEMU_PLUGIN_MEM_VALUE_U8,
+    QEMU_PLUGIN_MEM_VALUE_U16,
+    QEMU_PLUGIN_MEM_VALUE_U32,
+    QEMU_PLUGIN_MEM_VALUE_U64,
+    QEMU_PLUGIN_MEM_VALUE_U128,
+};
+
+/**
+ * typedef qemu_plugin_mem_value - value accessed during a load or store
+ *
+ * @type: which member of @data is valid
+ * @data: the value, in host byte order
+ */
+typedef struct {
+    enum qemu_plugin_mem_value_type type;
+    union {
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        struct {
+            uint64_t low;
+            uint64_t high;
+        } u128;
+    } data;
+} qemu_plugin_mem_value;
+
 /**
  * qemu_plugin_mem_size_shift() - get size of access
  * @info: opaque memory transaction handle
@@ -467,6 +685,21 @@ bool qemu_plugin_mem_is_big_endian(qemu_plugin_meminfo_t info);
 QEMU_PLUGIN_API
 bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info);
 
+/**
+ * qemu_plugin_mem_get_value() - return the value of a memory access
+ * @info: opaque memory transaction handle
+ *
+ * Only valid from within a memory callback for the access described by
+ * @info. For a load this is the value read, for a store the value
+ * written, both after any byte swapping implied by the access. For an
+ * atomic read-modify-write it is the value the operation returns to the
+ * guest.
+ *
+ * Returns: the value accessed, sized according to the access
+ */
+QEMU_PLUGIN_API
+qemu_plugin_mem_value qemu_plugin_mem_get_value(qemu_plugin_meminfo_t info);
+
 /**
  * qemu_plugin_get_hwaddr() - return handle for memory operation
  * @info: opaque memory info structure
@@ -576,6 +809,97 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU memory inline op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the op, of type qemu_plugin_op
+ * @entry: entry of a scoreboard to apply the op to
+ * @imm: immediate data for @op
+ *
+ * Like qemu_plugin_register_vcpu_mem_inline(), but the op is applied to
+ * @entry in the slot of the vCPU performing the access.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm);
+
+/**
+ * typedef qemu_plugin_mem_record - a memory access in a trace buffer
+ *
+ * @vaddr: virtual address of the access
+ * @value: value accessed, the low 64 bits of it for 128 bit accesses
+ * @info: the access, see the qemu_plugin_mem_* query functions
+ */
+typedef struct {
+    uint64_t vaddr;
+    uint64_t value;
+    qemu_plugin_meminfo_t info;
+    uint32_t reserved;
+} qemu_plugin_mem_record;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_trace_cb_t - memory trace callback
+ * @vcpu_index: the vCPU that made the accesses
+ * @records: the accesses, oldest first
+ * @n: number of entries in @records
+ * @userdata: user data given to qemu_plugin_mem_trace_new()
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void
+(*qemu_plugin_vcpu_mem_trace_cb_t)(unsigned int vcpu_index,
+                                   const qemu_plugin_mem_record *records,
+                                   size_t n, void *userdata);
+
+/** struct qemu_plugin_mem_trace - opaque memory trace handle */
+struct qemu_plugin_mem_trace;
+
+/**
+ * qemu_plugin_mem_trace_new() - allocate a memory trace
+ * @id: the unique plugin id
+ * @n_records: capacity of the buffer of each vCPU, in records; smaller
+ *   values, including 0, are raised to a minimum of 1024
+ * @cb: called with the content of a vCPU's buffer when it is flushed
+ * @userdata: passed to @cb
+ *
+ * Accesses registered with qemu_plugin_register_vcpu_mem_trace() are
+ * written by the translated code into a buffer owned by the vCPU that
+ * made them, and only handed to @cb in batches. A buffer is flushed when
+ * it has no room left for the next instruction's accesses, before an
+ * access made from a helper (which is reported on its own), before the
+ * vCPU's discontinuity callbacks run for an exception or interrupt,
+ * whenever the vCPU leaves its execution loop (to halt, stop or exit),
+ * and before the atexit callbacks run. In particular nothing is left
+ * buffered across a reset or loadvm.
+ *
+ * Records do not allow hardware address lookups: use regular memory
+ * callbacks if you need qemu_plugin_get_hwaddr().
+ *
+ * Returns: a new trace, which lives until the plugin is uninstalled
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_trace *
+qemu_plugin_mem_trace_new(qemu_plugin_id_t id, size_t n_records,
+                          qemu_plugin_vcpu_mem_trace_cb_t cb,
+                          void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_trace() - trace memory accesses
+ * @insn: handle for instruction to instrument
+ * @rw: trace reads, writes or both
+ * @trace: trace to append the accesses to
+ *
+ * This is the batched counterpart of qemu_plugin_register_vcpu_mem_cb():
+ * instead of a call per access, the translated code appends a record to
+ * @trace.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_trace(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_trace *trace);
+
 
 
 typedef void
@@ -597,6 +921,58 @@ void
 qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_syscall_ret_cb_t cb);
 
+/**
+ * enum qemu_plugin_discon_type - type of a control flow discontinuity
+ *
+ * @QEMU_PLUGIN_DISCON_INTERRUPT: an asynchronous interrupt was taken
+ * @QEMU_PLUGIN_DISCON_EXCEPTION: a synchronous exception (fault, trap,
+ * system call instruction...) was taken
+ * @QEMU_PLUGIN_DISCON_ALL: all of the above
+ *
+ * The values form a mask when registering a callback.
+ */
+enum qemu_plugin_discon_type {
+    QEMU_PLUGIN_DISCON_INTERRUPT = 1,
+    QEMU_PLUGIN_DISCON_EXCEPTION = 2,
+    QEMU_PLUGIN_DISCON_ALL = 3,
+};
+
+/**
+ * typedef qemu_plugin_vcpu_discon_cb_t - discontinuity callback
+ * @id: plugin ID
+ * @vcpu_index: the vCPU that took the interrupt or exception
+ * @type: which kind of discontinuity it was
+ * @cause: target specific exception number, as used by QEMU to
+ * deliver it, or UINT64_MAX for interrupts the target delivers without one
+ * @from_pc: PC at which the vCPU was interrupted, that is the faulting
+ * instruction for an exception
+ * @to_pc: PC of the handler the vCPU continues at
+ *
+ * PCs are only reported for targets that expose their PC to common
+ * code, they are 0 otherwise.
+ */
+typedef void
+(*qemu_plugin_vcpu_discon_cb_t)(qemu_plugin_id_t id, unsigned int vcpu_index,
+                                enum qemu_plugin_discon_type type,
+                                uint64_t cause, uint64_t from_pc,
+                                uint64_t to_pc);
+
+/**
+ * qemu_plugin_register_vcpu_discon_cb() - register a discontinuity callback
+ * @id: plugin ID
+ * @type: mask of the discontinuities to be called for
+ * @cb: callback function
+ *
+ * The callback fires once the target has entered the handler, from the
+ * vCPU thread. Only system emulation reports discontinuities: in
+ * user-mode emulation exceptions are handled by the target's cpu_loop
+ * and reach plugins as syscalls or not at all.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_discon_cb(qemu_plugin_id_t id,
+                                         enum qemu_plugin_discon_type type,
+                                         qemu_plugin_vcpu_discon_cb_t cb);
+
 
 /**
  * qemu_plugin_insn_disas() - return disassembly string for instruction
@@ -635,11 +1011,80 @@ void qemu_plugin_vcpu_for_each(qemu_plugin_id_t id,
  * qemu_plugin_register_monitor_cmd_cb() - register a monitor command callback
  * @id: plugin ID
  * @cb: callback function
+ *
+ * @cb is offered plugin-command requests addressed to a name no plugin
+ * registered with qemu_plugin_register_qmp_cmd_cb(), and its text reply
+ * is returned as a JSON string. The reply must be allocated with
+ * g_malloc(). New plugins should use qemu_plugin_register_qmp_cmd_cb().
  */
 QEMU_PLUGIN_API
 void qemu_plugin_register_monitor_cmd_cb(qemu_plugin_id_t id,
                                          qemu_plugin_monitor_cmd_cb_t cb);
 
+/**
+ * typedef qemu_plugin_qmp_cmd_cb_t - QMP command handler
+ * @id: the unique qemu_plugin_id_t
+ * @command: the command sent by the client
+ * @arguments: the arguments of the command as JSON text, or NULL
+ * @reply: set by the handler to its reply
+ * @userdata: user data given at registration
+ *
+ * On success @reply must be set to JSON text, which QEMU parses and
+ * returns to the client. On failure it may be set to an error message.
+ * In both cases it is released with the free callback given at
+ * registration.
+ *
+ * Returns: true on success, false if the command failed
+ */
+typedef bool (*qemu_plugin_qmp_cmd_cb_t)(qemu_plugin_id_t id,
+                                         const char *command,
+                                         const char *arguments,
+                                         char **reply, void *userdata);
+
+/**
+ * typedef qemu_plugin_qmp_free_cb_t - release a QMP command reply
+ * @reply: reply set by a qemu_plugin_qmp_cmd_cb_t
+ */
+typedef void (*qemu_plugin_qmp_free_cb_t)(char *reply);
+
+/**
+ * qemu_plugin_register_qmp_cmd_cb() - handle the plugin-command QMP command
+ * @id: plugin ID
+ * @name: name clients address the plugin with
+ * @cb: handler for the commands sent to @name
+ * @free_reply: releases the replies of @cb, g_free() if NULL
+ * @userdata: passed to @cb
+ *
+ * Commands are delivered from the main loop with the BQL held, possibly
+ * while vCPUs are running. Each plugin can register one handler, which
+ * also names the plugin in the events it sends with
+ * qemu_plugin_qmp_event(). The same commands are available from HMP
+ * with plugin_run.
+ *
+ * Returns: true on success, false if @name is taken, the plugin already
+ * registered a handler or QMP is not available (user-mode emulation).
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_register_qmp_cmd_cb(qemu_plugin_id_t id, const char *name,
+                                     qemu_plugin_qmp_cmd_cb_t cb,
+                                     qemu_plugin_qmp_free_cb_t free_reply,
+                                     void *userdata);
+
+/**
+ * qemu_plugin_qmp_event() - send a PLUGIN_EVENT to QMP clients
+ * @id: plugin ID
+ * @event: name of the event
+ * @data: JSON text attached to the event, or NULL
+ *
+ * Can be called from any callback. @data is copied before returning.
+ *
+ * Returns: true if the event was sent, false if @data is not valid JSON
+ * or QMP is not available (user-mode emulation).
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_qmp_event(qemu_plugin_id_t id, const char *event,
+                           const char *data);
+
 QEMU_PLUGIN_API
 void qemu_plugin_register_flush_cb(qemu_plugin_id_t id,
                                    qemu_plugin_simple_cb_t cb);
@@ -749,4 +1194,370 @@ bool qemu_plugin_write_memory_vaddr(uint64_t addr, const uint8_t *buf,
  */
 void qemu_plugin_tb_flush(void);
 
+/*
+ * VM control
+ *
+ * These requests let a plugin end a trial from its own callbacks. They
+ * only record what should happen and return immediately: the action is
+ * carried out later by the main loop, so they are safe to call from any
+ * callback. The vCPU making the request stops at the end of its current
+ * TB; other vCPUs may run a little longer until the main loop stops them.
+ * They are not available in user-mode emulation, where they return
+ * false.
+ */
+
+/**
+ * qemu_plugin_vm_request_reset() - reset the machine
+ *
+ * Equivalent to the system_reset monitor command, except that the RESET
+ * event reports the host-plugin cause.
+ *
+ * Returns: true if the request was queued
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_vm_request_reset(void);
+
+/**
+ * qemu_plugin_vm_request_pause() - stop the machine
+ *
+ * Equivalent to the stop monitor command: the machine can be resumed
+ * with cont.
+ *
+ * Returns: true if the request was queued
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_vm_request_pause(void);
+
+/**
+ * qemu_plugin_vm_request_exit() - shut the machine down
+ * @exit_code: exit status of the QEMU process
+ *
+ * QEMU exits with @exit_code, unless the shutdown action was set to
+ * pause with -action shutdown=pause, in which case the machine is only
+ * stopped. The SHUTDOWN event reports the host-plugin cause.
+ *
+ * Returns: true if the request was queued
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_vm_request_exit(int exit_code);
+
+/**
+ * typedef qemu_plugin_vm_snapshot_cb_t - snapshot load completion
+ * @id: the unique qemu_plugin_id_t
+ * @success: whether the snapshot was loaded
+ * @userdata: user data given to qemu_plugin_vm_request_load_snapshot()
+ *
+ * Called from the main loop with all vCPUs stopped, before the machine
+ * is resumed on success.
+ */
+typedef void (*qemu_plugin_vm_snapshot_cb_t)(qemu_plugin_id_t id,
+                                             bool success, void *userdata);
+
+/**
+ * qemu_plugin_vm_request_load_snapshot() - revert to an internal snapshot
+ * @id: plugin ID
+ * @name: name of the snapshot, as given to savevm
+ * @cb: if not NULL, called once the load is over
+ * @userdata: passed to @cb
+ *
+ * Equivalent to the loadvm monitor command. If the load fails the
+ * machine stays stopped, as with loadvm. Only one load can be pending at
+ * a time.
+ *
+ * Returns: true if the request was queued, false if another load is
+ * already pending
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_vm_request_load_snapshot(qemu_plugin_id_t id,
+                                          const char *name,
+                                          qemu_plugin_vm_snapshot_cb_t cb,
+                                          void *userdata);
+
+/**
+ * qemu_plugin_register_service() - publish a service to other plugins
+ * @id: plugin ID
+ * @name: unique name of the service
+ * @version: version of the layout of @table
+ * @table: table of function pointers (or any data) to publish
+ *
+ * Makes @table available to plugins loaded after this one through
+ * qemu_plugin_lookup_service(). @table must remain valid until the
+ * plugin is uninstalled, at which point the service is withdrawn.
+ *
+ * Returns: true on success, false if @name is already registered.
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_register_service(qemu_plugin_id_t id, const char *name,
+                                  uint32_t version, const void *table);
+
+/**
+ * qemu_plugin_lookup_service() - find a service published by a plugin
+ * @id: plugin ID
+ * @name: name of the service
+ * @min_version: oldest layout version the caller can use
+ * @version: if not NULL, set to the version of the returned table
+ *
+ * This is usually called from qemu_plugin_install(). Since plugins are
+ * installed in command line order, a NULL return at that point means
+ * the providing plugin is missing or was given after the caller.
+ *
+ * A successful lookup records the caller as a user of the service: the
+ * providing plugin then refuses to be uninstalled until the caller is.
+ * Anything the caller registered with the provider (such as a callback)
+ * must be withdrawn from its atexit callback.
+ *
+ * Returns: the published table, or NULL if no compatible service is
+ * registered under @name.
+ */
+QEMU_PLUGIN_API
+const void *qemu_plugin_lookup_service(qemu_plugin_id_t id, const char *name,
+                                       uint32_t min_version,
+                                       uint32_t *version);
+
+/**
+ * struct qemu_plugin_vmstate_stream - Opaque handle for a vmstate section
+ */
+struct qemu_plugin_vmstate_stream;
+
+/**
+ * typedef qemu_plugin_vmstate_save_cb_t - vmstate save callback
+ * @id: the unique qemu_plugin_id_t
+ * @s: stream to write the plugin state to
+ * @userdata: user data supplied at registration
+ */
+typedef void (*qemu_plugin_vmstate_save_cb_t)(
+    qemu_plugin_id_t id, struct qemu_plugin_vmstate_stream *s, void *userdata);
+
+/**
+ * typedef qemu_plugin_vmstate_load_cb_t - vmstate load callback
+ * @id: the unique qemu_plugin_id_t
+ * @s: stream to read the plugin state from
+ * @version: version the section was saved with
+ * @userdata: user data supplied at registration
+ *
+ * The callback must consume exactly what the save callback wrote.
+ *
+ * Returns: 0 on success, a negative errno value to fail the load.
+ */
+typedef int (*qemu_plugin_vmstate_load_cb_t)(
+    qemu_plugin_id_t id, struct qemu_plugin_vmstate_stream *s, int version,
+    void *userdata);
+
+/**
+ * qemu_plugin_register_vmstate() - save plugin state in VM snapshots
+ * @id: plugin ID
+ * @name: name of the section, unique among plugins
+ * @version: current version of the section layout
+ * @save: called by savevm and outgoing migration
+ * @load: called by loadvm and incoming migration
+ * @userdata: passed to @save and @load
+ *
+ * Adds a "plugin/@name" section to the device state of the VM. Both
+ * callbacks run with the VM stopped. Only available in system
+ * emulation.
+ *
+ * Note that a snapshot containing the section can only be loaded with
+ * a plugin registering it, with a @version at least as recent.
+ *
+ * Returns: true on success, false otherwise.
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_register_vmstate(qemu_plugin_id_t id, const char *name,
+                                  int version,
+                                  qemu_plugin_vmstate_save_cb_t save,
+                                  qemu_plugin_vmstate_load_cb_t load,
+                                  void *userdata);
+
+/**
+ * qemu_plugin_vmstate_put() - write raw bytes to a vmstate section
+ * @s: stream passed to the save callback
+ * @buf: data to write
+ * @len: size of @buf
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_vmstate_put(struct qemu_plugin_vmstate_stream *s,
+                             const void *buf, size_t len);
+
+/**
+ * qemu_plugin_vmstate_get() - read raw bytes from a vmstate section
+ * @s: stream passed to the load callback
+ * @buf: destination
+ * @len: number of bytes to read
+ *
+ * Returns: true if @len bytes were read.
+ */
+QEMU_PLUGIN_API
+bool qemu_plugin_vmstate_get(struct qemu_plugin_vmstate_stream *s,
+                             void *buf, size_t len);
+
+/**
+ * qemu_plugin_vmstate_put_u64() - write a 64 bit value to a vmstate section
+ * @s: stream passed to the save callback
+ * @val: value, stored in a host independent byte order
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_vmstate_put_u64(struct qemu_plugin_vmstate_stream *s,
+                                 uint64_t val);
+
+/**
+ * qemu_plugin_vmstate_get_u64() - read a 64 bit value from a vmstate section
+ * @s: stream passed to the load callback
+ *
+ * Returns: the value, or 0 once the stream is in error.
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_vmstate_get_u64(struct qemu_plugin_vmstate_stream *s);
+
+/** struct qemu_plugin_register - Opaque handle for register access */
+struct qemu_plugin_register;
+
+/**
+ * typedef qemu_plugin_reg_descriptor - register descriptions
+ *
+ * @handle: opaque handle for retrieving value with qemu_plugin_read_register
+ * @name: register name
+ * @feature: optional feature descriptor, can be NULL
+ */
+typedef struct {
+    struct qemu_plugin_register *handle;
+    const char *name;
+    const char *feature;
+} qemu_plugin_reg_descriptor;
+
+/**
+ * qemu_plugin_get_registers() - return register list for current vCPU
+ *
+ * Returns a GArray of qemu_plugin_reg_descriptor, describing the
+ * registers exposed through the gdbstub XML descriptions of the vCPU
+ * the caller runs on. It must therefore be called from a callback
+ * executed by a vCPU, e.g. the translation callback. The caller frees
+ * the array (but not the strings it points to).
+ *
+ * Handles depend only on the vCPU model and can be cached and reused
+ * for any vCPU, so a read never needs a lookup by name.
+ */
+QEMU_PLUGIN_API
+GArray *qemu_plugin_get_registers(void);
+
+/**
+ * qemu_plugin_read_register() - read register for current vCPU
+ *
+ * @handle: a handle from qemu_plugin_get_registers()
+ * @buf: A GByteArray for the data owned by the plugin
+ *
+ * This function is only available in a context where the callback
+ * declared QEMU_PLUGIN_CB_R_REGS or QEMU_PLUGIN_CB_RW_REGS. The value
+ * is appended to @buf in target byte order. Note that the program
+ * counter is not updated for every instruction on all targets, use
+ * qemu_plugin_insn_vaddr() to know which instruction is executing.
+ *
+ * Returns the size of the read register, or -1 on failure, including
+ * when the calling callback did not declare register access.
+ */
+QEMU_PLUGIN_API
+int qemu_plugin_read_register(struct qemu_plugin_register *handle,
+                              GByteArray *buf);
+
+/**
+ * qemu_plugin_write_register() - write register for current vCPU
+ *
+ * @handle: a handle from qemu_plugin_get_registers()
+ * @buf: A GByteArray holding the new value, in target byte order
+ *
+ * This function is only available in a context where the callback
+ * declared QEMU_PLUGIN_CB_RW_REGS; translated code reloads the guest
+ * state once the callback returns.
+ *
+ * @buf must hold exactly as many bytes as qemu_plugin_read_register()
+ * returns for the register.
+ *
+ * Returns the size of the written register, or -1 on failure, including
+ * when the calling callback did not declare QEMU_PLUGIN_CB_RW_REGS or
+ * @buf does not match the size of the register.
+ */
+QEMU_PLUGIN_API
+int qemu_plugin_write_register(struct qemu_plugin_register *handle,
+                               GByteArray *buf);
+
+/**
+ * qemu_plugin_scoreboard_new() - alloc a new scoreboard
+ * @element_size: size (in bytes) for one entry
+ *
+ * A scoreboard is an array of values, indexed by vcpu_index, with one
+ * entry per vCPU. Each entry is padded to a whole number of cache lines
+ * so that vCPUs updating their own entry never contend with each other.
+ * Entries are zero-initialized, and the scoreboard grows automatically
+ * when new vCPUs are created, preserving existing values.
+ *
+ * Returns: a new scoreboard. It must be freed using
+ * qemu_plugin_scoreboard_free().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * Translated code may still refer to the scoreboard through inline ops,
+ * so this should only be called once instrumentation using it can no
+ * longer run, e.g. from an atexit callback.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get pointer to an entry of a scoreboard
+ * @score: scoreboard to query
+ * @vcpu_index: entry index
+ *
+ * Returns: address of entry of a scoreboard matching a given vcpu_index. This
+ * address can be modified later if scoreboard is resized, so it should not be
+ * kept across callbacks.
+ */
+QEMU_PLUGIN_API
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Macros to define a qemu_plugin_u64 */
+#define qemu_plugin_scoreboard_u64(score) \
+    (qemu_plugin_u64) {score, 0}
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    (qemu_plugin_u64) {score, offsetof(type, member)}
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @added: value to add
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @val: new value
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - return sum of all vcpu entries in a scoreboard
+ * @entry: entry to sum
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 #endif /* QEMU_QEMU_PLUGIN_H */
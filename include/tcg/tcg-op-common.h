@@ -513,6 +513,12 @@ static inline void tcg_gen_movi_ptr(TCGv_ptr d, intptr_t s)
     glue(tcg_gen_movi_,PTR)((NAT)d, s);
 }
 
+static inline void tcg_gen_brcond_ptr(TCGCond cond, TCGv_ptr a,
+                                      TCGv_ptr b, TCGLabel *label)
+{
+    glue(tcg_gen_brcond_,PTR)(cond, (NAT)a, (NAT)b, label);
+}
+
 static inline void tcg_gen_brcondi_ptr(TCGCond cond, TCGv_ptr a,
                                        intptr_t b, TCGLabel *label)
 {
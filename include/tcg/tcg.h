@@ -553,6 +553,13 @@ struct TCGContext {
     QTAILQ_HEAD(, TCGOp) ops, free_ops;
     QSIMPLEQ_HEAD(, TCGLabel) labels;
 
+    /*
+     * When non-NULL, newly emitted ops are inserted before this op
+     * instead of being appended to the op stream. Used to generate code
+     * into an already translated block, e.g. for plugin instrumentation.
+     */
+    TCGOp *emit_before_op;
+
     /* Tells which temporary holds a given register.
        It does not take into account fixed registers */
     TCGTemp *reg_to_temp[TCG_TARGET_NB_REGS];
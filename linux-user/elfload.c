@@ -3684,6 +3684,33 @@ static const char *lookup_symbolxx(struct syminfo *s, uint64_t orig_addr)
     return "";
 }
 
+static bool lookup_namexx(struct syminfo *s, const char *name,
+                          uint64_t *start, uint64_t *size)
+{
+#if ELF_CLASS == ELFCLASS32
+    struct elf_sym *syms = s->disas_symtab.elf32;
+#else
+    struct elf_sym *syms = s->disas_symtab.elf64;
+#endif
+    unsigned int i;
+
+    for (i = 0; i < s->disas_num_syms; i++) {
+        int type = ELF_ST_TYPE(syms[i].st_info);
+
+        /* only code and data have an address range worth filtering on */
+        if (type != STT_FUNC && type != STT_OBJECT) {
+            continue;
+        }
+        if (strcmp(s->disas_strtab + syms[i].st_name, name) == 0) {
+            *start = syms[i].st_value;
+            *size = syms[i].st_size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /* FIXME: This should use elf_ops.h  */
 static int symcmp(const void *s0, const void *s1)
 {
@@ -3802,6 +3829,7 @@ static void load_symbols(struct elfhdr *hdr, const ImageSource *src,
         s->disas_symtab.elf64 = syms;
 #endif
         s->lookup_symbol = lookup_symbolxx;
+        s->lookup_name = lookup_namexx;
         s->next = syminfos;
         syminfos = s;
     }
@@ -37,6 +37,8 @@
 #include "qemu/cutils.h"
 #include "qemu/plugin.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qstring.h"
 
 #if defined(TARGET_S390X)
 #include "hw/s390x/storage-keys.h"
@@ -51,15 +53,41 @@ static void hmp_info_vtime(Monitor *mon, const QDict *qdict)
     monitor_printf(mon, "virtual time: %ld ns\n", qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
 }
 
-static void qmp_plugin_command(Monitor *mon, const QDict *qdict)
+#ifdef CONFIG_PLUGIN
+static void hmp_plugin_run(Monitor *mon, const QDict *qdict)
 {
-    const char *target_plugin = qdict_get_str(qdict, "plugin");
-    const char *plugin_cmd = qdict_get_str(qdict, "command");
+    const char *plugin = qdict_get_str(qdict, "plugin");
+    const char *command = qdict_get_str(qdict, "command");
+    const char *arguments = qdict_get_try_str(qdict, "arguments");
+    PluginCommandResult *res;
+    QObject *args = NULL;
+    Error *err = NULL;
+
+    if (arguments) {
+        args = qobject_from_json(arguments, &err);
+        if (hmp_handle_error(mon, err)) {
+            return;
+        }
+    }
+
+    res = qmp_plugin_command(plugin, command, args, &err);
+    qobject_unref(args);
+    if (hmp_handle_error(mon, err)) {
+        return;
+    }
+
+    /* print text replies as they are, like before the QMP command */
+    if (qobject_type(res->reply) == QTYPE_QSTRING) {
+        monitor_printf(mon, "%s\n",
+                       qstring_get_str(qobject_to(QString, res->reply)));
+    } else {
+        g_autoptr(GString) json = qobject_to_json_pretty(res->reply, true);
 
-    char *output = qemu_plugin_monitor_cmd_cb(target_plugin, plugin_cmd);
-    if (output != NULL)
-        monitor_printf(mon, "%s\n", output);
+        monitor_printf(mon, "%s\n", json->str);
+    }
+    qapi_free_PluginCommandResult(res);
 }
+#endif
 
 static HMPCommand hmp_info_cmds[];
 
@@ -42,6 +42,7 @@
 #include "exec/cpu-common.h"
 #include "exec/ram_addr.h"
 #include "disas/disas.h"
+#include "exec/gdbstub.h"
 #include "plugin.h"
 #ifndef CONFIG_USER_ONLY
 #include "qemu/plugin-memory.h"
@@ -57,12 +58,12 @@
 
 void qemu_plugin_uninstall(qemu_plugin_id_t id, qemu_plugin_simple_cb_t cb)
 {
-    plugin_reset_uninstall(id, cb, false);
+    plugin_reset_uninstall(id, cb, false, false);
 }
 
 void qemu_plugin_reset(qemu_plugin_id_t id, qemu_plugin_simple_cb_t cb)
 {
-    plugin_reset_uninstall(id, cb, true);
+    plugin_reset_uninstall(id, cb, true, false);
 }
 
 /*
@@ -104,6 +105,16 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm)
+{
+    if (!tb->mem_only) {
+        plugin_register_inline_op_on_entry(&tb->cbs[PLUGIN_CB_INLINE],
+                                           0, op, entry, imm);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
@@ -125,6 +136,42 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm)
+{
+    if (!insn->mem_only) {
+        plugin_register_inline_op_on_entry(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], 0, op, entry, imm);
+    }
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t add, uint64_t imm,
+                                               void *udata)
+{
+    if (!tb->mem_only) {
+        plugin_register_dyn_cond_cb__udata(&tb->cbs[PLUGIN_CB_COND], cb, flags,
+                                           cond, entry, add, imm, udata);
+    }
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn, qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags, enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry, uint64_t add, uint64_t imm, void *udata)
+{
+    if (!insn->mem_only) {
+        plugin_register_dyn_cond_cb__udata(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], cb, flags,
+            cond, entry, add, imm, udata);
+    }
+}
+
 
 /*
  * We always plant memory instrumentation because they don't finalise until
@@ -149,6 +196,22 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                               rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm)
+{
+    plugin_register_inline_op_on_entry(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], rw, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_trace(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_trace *trace)
+{
+    plugin_register_vcpu_mem_trace(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE],
+                                   rw, trace);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -168,6 +231,15 @@ qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
     plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SYSCALL_RET, cb);
 }
 
+void
+qemu_plugin_register_vcpu_discon_cb(qemu_plugin_id_t id,
+                                    enum qemu_plugin_discon_type type,
+                                    qemu_plugin_vcpu_discon_cb_t cb)
+{
+    plugin_register_cb_udata(id, QEMU_PLUGIN_EV_VCPU_DISCON, cb,
+                             GUINT_TO_POINTER(type));
+}
+
 void
 qemu_plugin_register_monitor_cmd_cb(qemu_plugin_id_t id,
                                     qemu_plugin_monitor_cmd_cb_t cb)
@@ -280,6 +352,39 @@ bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info)
     return get_plugin_meminfo_rw(info) & QEMU_PLUGIN_MEM_W;
 }
 
+qemu_plugin_mem_value qemu_plugin_mem_get_value(qemu_plugin_meminfo_t info)
+{
+    uint64_t low = current_cpu->plugin_mem_value_low;
+    qemu_plugin_mem_value value;
+
+    switch (get_memop(info) & MO_SIZE) {
+    case MO_8:
+        value.type = QEMU_PLUGIN_MEM_VALUE_U8;
+        value.data.u8 = low;
+        break;
+    case MO_16:
+        value.type = QEMU_PLUGIN_MEM_VALUE_U16;
+        value.data.u16 = low;
+        break;
+    case MO_32:
+        value.type = QEMU_PLUGIN_MEM_VALUE_U32;
+        value.data.u32 = low;
+        break;
+    case MO_64:
+        value.type = QEMU_PLUGIN_MEM_VALUE_U64;
+        value.data.u64 = low;
+        break;
+    case MO_128:
+        value.type = QEMU_PLUGIN_MEM_VALUE_U128;
+        value.data.u128.low = low;
+        value.data.u128.high = current_cpu->plugin_mem_value_high;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    return value;
+}
+
 /*
  * Virtual Memory queries
  */
@@ -462,3 +567,67 @@ void qemu_plugin_tb_flush(void)
         tb_flush(cpu);
     }
 }
+
+/*
+ * Register handles encode the gdb register number, offset by one so
+ * that register 0 does not produce a NULL handle.
+ */
+GArray *qemu_plugin_get_registers(void)
+{
+    CPUState *cpu = current_cpu;
+    g_autoptr(GArray) regs = NULL;
+    GArray *descs;
+
+    if (!cpu) {
+        return NULL;
+    }
+
+    regs = gdb_get_register_list(cpu);
+    descs = g_array_sized_new(false, false,
+                              sizeof(qemu_plugin_reg_descriptor), regs->len);
+    for (guint i = 0; i < regs->len; i++) {
+        GDBRegDesc *grd = &g_array_index(regs, GDBRegDesc, i);
+        qemu_plugin_reg_descriptor desc = {
+            .handle = GINT_TO_POINTER(grd->gdb_reg + 1),
+            .name = grd->name,
+            .feature = grd->feature_name,
+        };
+        g_array_append_val(descs, desc);
+    }
+    return descs;
+}
+
+int qemu_plugin_read_register(struct qemu_plugin_register *reg,
+                              GByteArray *buf)
+{
+    CPUState *cpu = current_cpu;
+    int size;
+
+    if (!cpu || !reg || cpu->plugin_cb_flags == QEMU_PLUGIN_CB_NO_REGS) {
+        return -1;
+    }
+    size = gdb_read_register(cpu, buf, GPOINTER_TO_INT(reg) - 1);
+    return size ? size : -1;
+}
+
+int qemu_plugin_write_register(struct qemu_plugin_register *reg,
+                               GByteArray *buf)
+{
+    CPUState *cpu = current_cpu;
+    g_autoptr(GByteArray) cur = NULL;
+    int size;
+
+    if (!cpu || !reg || !buf ||
+        cpu->plugin_cb_flags != QEMU_PLUGIN_CB_RW_REGS) {
+        return -1;
+    }
+
+    /* gdb_write_register() consumes the full width of the register */
+    cur = g_byte_array_new();
+    size = gdb_read_register(cpu, cur, GPOINTER_TO_INT(reg) - 1);
+    if (size == 0 || buf->len != size) {
+        return -1;
+    }
+    size = gdb_write_register(cpu, buf->data, GPOINTER_TO_INT(reg) - 1);
+    return size ? size : -1;
+}
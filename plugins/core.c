@@ -28,6 +28,20 @@
 #include "tcg/tcg-op.h"
 #include "plugin.h"
 #include "qemu/compiler.h"
+#include "disas/disas.h"
+#ifndef CONFIG_USER_ONLY
+#include "migration/register.h"
+#include "migration/vmstate.h"
+#include "migration/qemu-file-types.h"
+#include "migration/snapshot.h"
+#include "qapi/qapi-commands-misc.h"
+#include "qapi/qapi-events-misc.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qstring.h"
+#include "sysemu/cpus.h"
+#include "sysemu/runstate.h"
+#include "qemu/main-loop.h"
+#endif
 
 struct qemu_plugin_cb {
     struct qemu_plugin_ctx *ctx;
@@ -36,8 +50,27 @@ struct qemu_plugin_cb {
     QLIST_ENTRY(qemu_plugin_cb) entry;
 };
 
+struct qemu_plugin_service {
+    struct qemu_plugin_ctx *ctx;
+    char *name;
+    uint32_t version;
+    const void *table;
+    /* plugins that looked the service up, and may hold on to @table */
+    GSList *users;
+};
+
 struct qemu_plugin_state plugin;
 
+/*
+ * Unchecked qemu_plugin_scoreboard_find() for the execution paths:
+ * scoreboards always have a slot for every vCPU that has been created.
+ */
+static inline void *plugin_scoreboard_slot(struct qemu_plugin_scoreboard *score,
+                                           unsigned int vcpu_index)
+{
+    return score->data + vcpu_index * score->stride;
+}
+
 struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id)
 {
     struct qemu_plugin_ctx *ctx;
@@ -87,6 +120,27 @@ void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
     }
 }
 
+/*
+ * A plugin loaded at run time has missed the init event of the existing
+ * vCPUs, replay it for that plugin only.
+ *
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_vcpu_init_replay__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_cb *cb = ctx->callbacks[QEMU_PLUGIN_EV_VCPU_INIT];
+    CPUState *cpu;
+
+    if (cb) {
+        CPU_FOREACH(cpu) {
+            cb->f.vcpu_simple(ctx->id, cpu->cpu_index);
+        }
+    }
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -238,11 +292,81 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+#ifdef CONFIG_USER_ONLY
+/* grow every scoreboard to @new_size slots, preserving their contents */
+static void plugin_resize_scoreboards__locked(size_t new_size)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t old_size = plugin.scoreboard_alloc_size;
+
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        void *data = qemu_memalign(PLUGIN_SCOREBOARD_ALIGN,
+                                   new_size * score->stride);
+
+        memcpy(data, score->data, old_size * score->stride);
+        memset(data + old_size * score->stride, 0,
+               (new_size - old_size) * score->stride);
+        qemu_vfree(score->data);
+        score->data = data;
+    }
+    plugin.scoreboard_alloc_size = new_size;
+}
+#endif
+
+/*
+ * Make room for @cpu in every scoreboard. Translated code embeds the
+ * address of the scoreboards, so the resize must happen with all vCPUs
+ * stopped and be followed by a flush of the code cache.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    size_t size = plugin.scoreboard_alloc_size;
+
+    if (cpu->cpu_index < size) {
+        return;
+    }
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        /* nothing to move, just size future scoreboards */
+        plugin.scoreboard_alloc_size = size;
+        return;
+    }
+
+#ifdef CONFIG_USER_ONLY
+    /*
+     * New vCPUs are created by clone(), i.e. from another vCPU's thread
+     * while it is outside cpu_exec, so we can stop the world from here.
+     * Drop the lock first: stopped vCPUs may be waiting on it.
+     */
+    qemu_rec_mutex_unlock(&plugin.lock);
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+
+    /* another thread may have grown the scoreboards in the meantime */
+    if (size > plugin.scoreboard_alloc_size) {
+        plugin_resize_scoreboards__locked(size);
+        /* in exclusive context, so this flushes synchronously */
+        tb_flush(current_cpu);
+    }
+    end_exclusive();
+#else
+    /*
+     * Scoreboards are sized for -smp maxcpus when created, and hot-added
+     * vCPUs can never exceed it.
+     */
+    g_assert_not_reached();
+#endif
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    plugin_grow_scoreboards__locked(cpu);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -256,6 +380,7 @@ void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    qemu_plugin_vcpu_mem_trace_flush(cpu);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -296,6 +421,7 @@ void qemu_plugin_vcpu_for_each(qemu_plugin_id_t id,
 static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 {
     GArray *cbs = *arr;
+    struct qemu_plugin_dyn_cb *cb;
 
     if (!cbs) {
         cbs = g_array_sized_new(false, false,
@@ -304,7 +430,10 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
     }
 
     g_array_set_size(cbs, cbs->len + 1);
-    return &g_array_index(cbs, struct qemu_plugin_dyn_cb, cbs->len - 1);
+    cb = &g_array_index(cbs, struct qemu_plugin_dyn_cb, cbs->len - 1);
+    /* arrays are reused across translations, don't leak old fields */
+    memset(cb, 0, sizeof(*cb));
+    return cb;
 }
 
 void plugin_register_inline_op(GArray **arr,
@@ -320,6 +449,29 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry.score = NULL;
+    dyn_cb->inline_insn.entry.offset = 0;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    /* every vCPU has a slot, see plugin_grow_scoreboards__locked() */
+    g_assert(entry.score);
+    g_assert(entry.offset + sizeof(uint64_t) <= entry.score->element_size);
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry = entry;
 }
 
 void plugin_register_dyn_cb__udata(GArray **arr,
@@ -330,11 +482,37 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
 
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
+    dyn_cb->flags = flags;
     dyn_cb->f.vcpu_udata = cb;
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t add, uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    /* nothing to update and nothing to call: don't bother instrumenting */
+    if (cond == QEMU_PLUGIN_COND_NEVER && add == 0) {
+        return;
+    }
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = udata;
+    dyn_cb->flags = flags;
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.add = add;
+    dyn_cb->cond.imm = imm;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -345,12 +523,174 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
 
     dyn_cb = plugin_get_dyn_cb(arr);
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
+    /* Note flags are discarded, memory callbacks can't access registers. */
     dyn_cb->type = PLUGIN_CB_REGULAR;
     dyn_cb->rw = rw;
     dyn_cb->f.generic = cb;
 }
 
+void plugin_register_vcpu_mem_trace(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    struct qemu_plugin_mem_trace *trace)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = trace;
+    dyn_cb->type = PLUGIN_CB_TRACE;
+    dyn_cb->rw = rw;
+}
+
+/*
+ * Translation filters
+ *
+ * A plugin may restrict the TBs offered to its tb_trans callback by
+ * start address and MMU index. TBs no plugin wants are translated with
+ * no plugin placeholder at all. Symbols are looked up when the first TB
+ * is translated, as the guest image is usually loaded after the plugins
+ * are installed; the filters are read-only from then on.
+ */
+static bool plugin_filter_begin(qemu_plugin_id_t id,
+                                struct qemu_plugin_ctx **pctx)
+{
+    struct qemu_plugin_ctx *ctx = plugin_id_to_ctx_locked(id);
+
+    if (!ctx->installing) {
+        error_report("plugin: translation filters can only be set from "
+                     "qemu_plugin_install()");
+        return false;
+    }
+    if (!ctx->filter_ranges) {
+        ctx->filter_ranges = g_array_new(false, false,
+                                         sizeof(struct qemu_plugin_pc_range));
+        ctx->filter_symbols = g_ptr_array_new_with_free_func(g_free);
+    }
+    *pctx = ctx;
+    return true;
+}
+
+static void plugin_filter_add(struct qemu_plugin_ctx *ctx,
+                              uint64_t start, uint64_t end)
+{
+    struct qemu_plugin_pc_range range = { .start = start, .end = end };
+
+    g_array_append_val(ctx->filter_ranges, range);
+}
+
+static void plugin_filter_resolve__locked(struct qemu_plugin_ctx *ctx)
+{
+    uint64_t start, size;
+    guint i;
+
+    if (!ctx->filter_symbols) {
+        return;
+    }
+    for (i = 0; i < ctx->filter_symbols->len; i++) {
+        const char *name = g_ptr_array_index(ctx->filter_symbols, i);
+
+        if (lookup_symbol_range(name, &start, &size)) {
+            plugin_filter_add(ctx, start, start + MAX(size, 1));
+        } else {
+            warn_report("plugin: %s: symbol '%s' not found, it will not "
+                        "be instrumented", ctx->desc->path, name);
+        }
+    }
+    g_ptr_array_set_size(ctx->filter_symbols, 0);
+}
+
+static void plugin_filters_resolve(void)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    if (likely(qatomic_load_acquire(&plugin.filters_resolved))) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (!plugin.filters_resolved) {
+        QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+            plugin_filter_resolve__locked(ctx);
+        }
+        qatomic_store_release(&plugin.filters_resolved, true);
+    }
+}
+
+static bool plugin_filter_match(const struct qemu_plugin_ctx *ctx,
+                                uint64_t pc, int mmu_idx)
+{
+    guint i;
+
+    if (ctx->filter_mmu_idx && !(ctx->filter_mmu_idx & BIT_ULL(mmu_idx))) {
+        return false;
+    }
+    if (!ctx->filter_ranges) {
+        return true;
+    }
+    for (i = 0; i < ctx->filter_ranges->len; i++) {
+        const struct qemu_plugin_pc_range *range =
+            &g_array_index(ctx->filter_ranges, struct qemu_plugin_pc_range, i);
+
+        if (pc >= range->start && pc < range->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool qemu_plugin_filter_add_range(qemu_plugin_id_t id,
+                                  uint64_t start, uint64_t end)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (start >= end || !plugin_filter_begin(id, &ctx)) {
+        return false;
+    }
+    plugin_filter_add(ctx, start, end);
+    return true;
+}
+
+bool qemu_plugin_filter_add_symbol(qemu_plugin_id_t id, const char *name)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (!name || !*name || !plugin_filter_begin(id, &ctx)) {
+        return false;
+    }
+    g_ptr_array_add(ctx->filter_symbols, g_strdup(name));
+    /* a plugin installed at run time sees the symbols loaded so far */
+    if (plugin.filters_resolved) {
+        plugin_filter_resolve__locked(ctx);
+    }
+    return true;
+}
+
+bool qemu_plugin_filter_mmu_idx(qemu_plugin_id_t id, uint64_t mask)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    if (!ctx->installing) {
+        error_report("plugin: translation filters can only be set from "
+                     "qemu_plugin_install()");
+        return false;
+    }
+    ctx->filter_mmu_idx = mask;
+    return true;
+}
+
+void plugin_unregister_filters__locked(struct qemu_plugin_ctx *ctx)
+{
+    if (ctx->filter_ranges) {
+        g_array_free(ctx->filter_ranges, true);
+        g_ptr_array_free(ctx->filter_symbols, true);
+        ctx->filter_ranges = NULL;
+        ctx->filter_symbols = NULL;
+    }
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -367,8 +707,24 @@ void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb)
     QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
         qemu_plugin_vcpu_tb_trans_cb_t func = cb->f.vcpu_tb_trans;
 
-        func(cb->ctx->id, tb);
+        if (plugin_filter_match(cb->ctx, tb->vaddr, tb->mmu_idx)) {
+            func(cb->ctx->id, tb);
+        }
+    }
+}
+
+bool qemu_plugin_tb_filter(uint64_t pc, int mmu_idx)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_TB_TRANS;
+
+    plugin_filters_resolve();
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        if (plugin_filter_match(cb->ctx, pc, mmu_idx)) {
+            return true;
+        }
     }
+    return false;
 }
 
 /*
@@ -418,6 +774,37 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
     }
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_vcpu_discon_cb(CPUState *cpu,
+                                enum qemu_plugin_discon_type type,
+                                uint64_t cause, uint64_t from_pc,
+                                uint64_t to_pc)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_DISCON;
+
+    if (!test_bit(ev, cpu->plugin_mask)) {
+        return;
+    }
+
+    /* the accesses that led to the discontinuity are reported first */
+    qemu_plugin_vcpu_mem_trace_flush(cpu);
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_discon_cb_t func = cb->f.vcpu_discon;
+
+        /* the udata of the callback holds the types it asked for */
+        if (GPOINTER_TO_UINT(cb->udata) & type) {
+            func(cb->ctx->id, cpu->cpu_index, type, cause, from_pc, to_pc);
+        }
+    }
+}
+
 void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_IDLE);
@@ -466,10 +853,15 @@ char *qemu_plugin_monitor_cmd_cb(const char *target_plugin,
     return plugin_cb__monitor(QEMU_PLUGIN_EV_MONITOR_CMD, target_plugin, cmd_data);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
     uint64_t *val = cb->userp;
 
+    if (cb->inline_insn.entry.score) {
+        val = plugin_scoreboard_slot(cb->inline_insn.entry.score, cpu_index) +
+              cb->inline_insn.entry.offset;
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
@@ -479,29 +871,115 @@ void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
     }
 }
 
+static struct qemu_plugin_mem_trace_cursor *
+plugin_mem_trace_cursor(struct qemu_plugin_mem_trace *trace,
+                        unsigned int cpu_index)
+{
+    return plugin_scoreboard_slot(trace->cursors, cpu_index);
+}
+
+/*
+ * Hand the records buffered by @cpu_index to the plugin and empty the
+ * buffer, allocating it on first use. Called from the vCPU's own thread,
+ * or once all vCPUs have stopped.
+ *
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_trace_flush(struct qemu_plugin_mem_trace *trace,
+                            unsigned int cpu_index)
+{
+    struct qemu_plugin_mem_trace_cursor *c =
+        plugin_mem_trace_cursor(trace, cpu_index);
+
+    if (c->start == NULL) {
+        c->start = g_new(qemu_plugin_mem_record, trace->n_records);
+        c->end = c->start + trace->n_records;
+        c->pos = c->start;
+        return;
+    }
+    if (c->pos != c->start) {
+        trace->cb(cpu_index, c->start, c->pos - c->start, trace->userdata);
+        c->pos = c->start;
+    }
+}
+
+/*
+ * Accesses made from helpers are not buffered: translated code only
+ * reserves room for its own records. Deliver what the vCPU has buffered
+ * so far and then this access on its own, which keeps program order.
+ *
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void
+plugin_mem_trace_helper_access(struct qemu_plugin_mem_trace *trace,
+                               CPUState *cpu, uint64_t vaddr,
+                               qemu_plugin_meminfo_t info)
+{
+    qemu_plugin_mem_record rec = {
+        .vaddr = vaddr,
+        .value = cpu->plugin_mem_value_low,
+        .info = info,
+    };
+
+    plugin_mem_trace_flush(trace, cpu->cpu_index);
+    trace->cb(cpu->cpu_index, &rec, 1, trace->userdata);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
+                             uint64_t value_low,
+                             uint64_t value_high,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw)
 {
     GArray *arr = cpu->plugin_mem_cbs;
+    qemu_plugin_meminfo_t info = make_plugin_meminfo(oi, rw);
+    struct qemu_plugin_dyn_cb *cb;
     size_t i;
 
     if (arr == NULL) {
         return;
     }
+
+    cpu->plugin_mem_value_low = value_low;
+    cpu->plugin_mem_value_high = value_high;
+
+    /* the common case: a single plugin with a single regular callback */
+    if (arr->len == 1) {
+        cb = &g_array_index(arr, struct qemu_plugin_dyn_cb, 0);
+        if (likely(cb->type == PLUGIN_CB_REGULAR)) {
+            if (rw & cb->rw) {
+                cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
+            }
+            return;
+        }
+    }
+
     for (i = 0; i < arr->len; i++) {
-        struct qemu_plugin_dyn_cb *cb =
-            &g_array_index(arr, struct qemu_plugin_dyn_cb, i);
+        cb = &g_array_index(arr, struct qemu_plugin_dyn_cb, i);
 
         if (!(rw & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
-            cb->f.vcpu_mem(cpu->cpu_index, make_plugin_meminfo(oi, rw),
-                           vaddr, cb->userp);
+            cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_TRACE:
+            plugin_mem_trace_helper_access(cb->userp, cpu, vaddr, info);
             break;
         default:
             g_assert_not_reached();
@@ -509,9 +987,761 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     }
 }
 
-void qemu_plugin_atexit_cb(void)
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
 {
-    plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
+    struct qemu_plugin_scoreboard *score =
+        g_new0(struct qemu_plugin_scoreboard, 1);
+    size_t size;
+
+    score->element_size = element_size;
+    score->stride = ROUND_UP(MAX(element_size, 1), PLUGIN_SCOREBOARD_ALIGN);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    /* in system mode, allocate for every vCPU that could be hot-added */
+    if (qemu_plugin_n_max_vcpus() > (int)plugin.scoreboard_alloc_size) {
+        plugin.scoreboard_alloc_size = qemu_plugin_n_max_vcpus();
+    }
+    size = plugin.scoreboard_alloc_size;
+    score->data = qemu_memalign(PLUGIN_SCOREBOARD_ALIGN, size * score->stride);
+    memset(score->data, 0, size * score->stride);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    qemu_vfree(score->data);
+    g_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < plugin.scoreboard_alloc_size);
+    return plugin_scoreboard_slot(score, vcpu_index);
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                    unsigned int vcpu_index)
+{
+    return qemu_plugin_scoreboard_find(entry.score, vcpu_index) +
+           entry.offset;
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    /* slots of vCPUs that never ran are zero, so summing them is harmless */
+    qemu_rec_mutex_lock(&plugin.lock);
+    for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+        total += *plugin_u64_address(entry, i);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    return total;
+}
+
+struct qemu_plugin_mem_trace *
+qemu_plugin_mem_trace_new(qemu_plugin_id_t id, size_t n_records,
+                          qemu_plugin_vcpu_mem_trace_cb_t cb,
+                          void *userdata)
+{
+    struct qemu_plugin_mem_trace *trace;
+    size_t cursor_size = sizeof(struct qemu_plugin_mem_trace_cursor);
+
+    trace = g_new0(struct qemu_plugin_mem_trace, 1);
+    trace->id = id;
+    trace->cursors = qemu_plugin_scoreboard_new(cursor_size);
+    trace->n_records = MAX(n_records, PLUGIN_MEM_TRACE_MIN_RECORDS);
+    trace->cb = cb;
+    trace->userdata = userdata;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_traces, trace, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return trace;
+}
+
+/* deliver the records still buffered, all vCPUs must have stopped */
+static void plugin_mem_trace_flush_all(void)
+{
+    struct qemu_plugin_mem_trace *trace;
+    size_t i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(trace, &plugin.mem_traces, entry) {
+        for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+            if (plugin_mem_trace_cursor(trace, i)->start) {
+                plugin_mem_trace_flush(trace, i);
+            }
+        }
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+}
+
+/*
+ * Called by @cpu when it leaves the execution loop, so that nothing stays
+ * buffered while it is stopped, exits or has its state replaced by a
+ * reset or loadvm, and before its discontinuity callbacks run.
+ */
+void qemu_plugin_vcpu_mem_trace_flush(CPUState *cpu)
+{
+    struct qemu_plugin_mem_trace *trace;
+
+    /* don't take the lock on every exception when nothing is traced */
+    if (QLIST_EMPTY_RCU(&plugin.mem_traces)) {
+        return;
+    }
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(trace, &plugin.mem_traces, entry) {
+        if (plugin_mem_trace_cursor(trace, cpu->cpu_index)->start) {
+            plugin_mem_trace_flush(trace, cpu->cpu_index);
+        }
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+}
+
+/* deliver the records buffered in the traces of @ctx */
+static void plugin_mem_trace_flush_ctx__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_mem_trace *trace;
+    size_t i;
+
+    QLIST_FOREACH(trace, &plugin.mem_traces, entry) {
+        if (trace->id != ctx->id) {
+            continue;
+        }
+        for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+            if (plugin_mem_trace_cursor(trace, i)->start) {
+                plugin_mem_trace_flush(trace, i);
+            }
+        }
+    }
+}
+
+/*
+ * Deliver what is left in the traces of @ctx and free them. Called at
+ * uninstall time, once its translated code has been flushed.
+ */
+void plugin_unregister_mem_traces__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_mem_trace *trace, *next;
+    size_t i;
+
+    plugin_mem_trace_flush_ctx__locked(ctx);
+    QLIST_FOREACH_SAFE(trace, &plugin.mem_traces, entry, next) {
+        if (trace->id != ctx->id) {
+            continue;
+        }
+        for (i = 0; i < plugin.scoreboard_alloc_size; i++) {
+            g_free(plugin_mem_trace_cursor(trace, i)->start);
+        }
+        QLIST_REMOVE(trace, entry);
+        qemu_plugin_scoreboard_free(trace->cursors);
+        g_free(trace);
+    }
+}
+
+static void plugin_service_free(gpointer p)
+{
+    struct qemu_plugin_service *svc = p;
+
+    g_slist_free(svc->users);
+    g_free(svc->name);
+    g_free(svc);
+}
+
+bool qemu_plugin_register_service(qemu_plugin_id_t id, const char *name,
+                                  uint32_t version, const void *table)
+{
+    struct qemu_plugin_service *svc;
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    if (unlikely(ctx->uninstalling)) {
+        return false;
+    }
+    svc = g_hash_table_lookup(plugin.services, name);
+    if (svc) {
+        error_report("plugin: service '%s' is already provided by %s",
+                     name, svc->ctx->desc->path);
+        return false;
+    }
+    svc = g_new(struct qemu_plugin_service, 1);
+    svc->ctx = ctx;
+    svc->name = g_strdup(name);
+    svc->version = version;
+    svc->table = table;
+    g_hash_table_insert(plugin.services, svc->name, svc);
+    return true;
+}
+
+const void *qemu_plugin_lookup_service(qemu_plugin_id_t id, const char *name,
+                                       uint32_t min_version,
+                                       uint32_t *version)
+{
+    struct qemu_plugin_service *svc;
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    svc = g_hash_table_lookup(plugin.services, name);
+    if (svc == NULL || svc->ctx->uninstalling) {
+        return NULL;
+    }
+    if (svc->version < min_version) {
+        error_report("plugin: service '%s' has version %" PRIu32
+                     ", at least %" PRIu32 " is required",
+                     name, svc->version, min_version);
+        return NULL;
+    }
+    if (version) {
+        *version = svc->version;
+    }
+    if (ctx != svc->ctx && !g_slist_find(svc->users, ctx)) {
+        svc->users = g_slist_prepend(svc->users, ctx);
+    }
+    return svc->table;
+}
+
+static gboolean plugin_service_owned_by(gpointer k, gpointer v, gpointer udata)
+{
+    struct qemu_plugin_service *svc = v;
+
+    return svc->ctx == udata;
+}
+
+void plugin_unregister_services__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_service *svc;
+    GHashTableIter iter;
+
+    g_hash_table_foreach_remove(plugin.services, plugin_service_owned_by, ctx);
+    g_hash_table_iter_init(&iter, plugin.services);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&svc)) {
+        svc->users = g_slist_remove(svc->users, ctx);
+    }
+}
+
+/*
+ * Return a plugin using one of the services provided by @ctx. The
+ * provider cannot go away before it, as it may still call into @ctx.
+ */
+struct qemu_plugin_ctx *
+plugin_service_user__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_service *svc;
+    GHashTableIter iter;
+
+    g_hash_table_iter_init(&iter, plugin.services);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&svc)) {
+        if (svc->ctx == ctx && svc->users) {
+            return svc->users->data;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Plugin QMP channel
+ *
+ * plugin-command is routed to the plugin that registered the requested
+ * name. Arguments and replies cross the plugin boundary as JSON text, so
+ * that plugins do not depend on QEMU's QObject implementation.
+ */
+#ifndef CONFIG_USER_ONLY
+static void plugin_qmp_free_reply(char *reply)
+{
+    g_free(reply);
+}
+
+bool qemu_plugin_register_qmp_cmd_cb(qemu_plugin_id_t id, const char *name,
+                                     qemu_plugin_qmp_cmd_cb_t cb,
+                                     qemu_plugin_qmp_free_cb_t free_reply,
+                                     void *userdata)
+{
+    struct qemu_plugin_ctx *ctx, *other;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    if (unlikely(ctx->uninstalling) || ctx->qmp_name) {
+        return false;
+    }
+    QTAILQ_FOREACH(other, &plugin.ctxs, entry) {
+        if (g_strcmp0(other->qmp_name, name) == 0) {
+            error_report("plugin: command name '%s' is already used by %s",
+                         name, other->desc->path);
+            return false;
+        }
+    }
+    ctx->qmp_name = g_strdup(name);
+    ctx->qmp_cb = cb;
+    ctx->qmp_free_reply = free_reply ? free_reply : plugin_qmp_free_reply;
+    ctx->qmp_userdata = userdata;
+    return true;
+}
+
+void plugin_unregister_qmp__locked(struct qemu_plugin_ctx *ctx)
+{
+    g_free(ctx->qmp_name);
+    ctx->qmp_name = NULL;
+    ctx->qmp_cb = NULL;
+}
+
+static struct qemu_plugin_ctx *plugin_qmp_lookup__locked(const char *name)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (!ctx->uninstalling && g_strcmp0(ctx->qmp_name, name) == 0) {
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+PluginCommandResult *qmp_plugin_command(const char *name, const char *command,
+                                        QObject *arguments, Error **errp)
+{
+    g_autoptr(GString) args = NULL;
+    struct qemu_plugin_ctx *ctx;
+    qemu_plugin_qmp_cmd_cb_t cb;
+    qemu_plugin_qmp_free_cb_t free_reply;
+    void *userdata;
+    PluginCommandResult *res;
+    char *reply = NULL;
+    QObject *obj = NULL;
+    bool ok;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    ctx = plugin_qmp_lookup__locked(name);
+    if (!ctx) {
+        qemu_rec_mutex_unlock(&plugin.lock);
+        /* plugins using the older text interface filter on @name */
+        reply = qemu_plugin_monitor_cmd_cb(name, command);
+        if (!reply) {
+            error_setg(errp, "No plugin handles commands for '%s'", name);
+            return NULL;
+        }
+        res = g_new0(PluginCommandResult, 1);
+        res->reply = QOBJECT(qstring_from_str(reply));
+        g_free(reply);
+        return res;
+    }
+    /*
+     * The handler may wait for plugin threads that call the API, so it
+     * runs unlocked; the reference keeps the module loaded meanwhile.
+     */
+    ctx->refcount++;
+    cb = ctx->qmp_cb;
+    free_reply = ctx->qmp_free_reply;
+    userdata = ctx->qmp_userdata;
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    if (arguments) {
+        args = qobject_to_json(arguments);
+    }
+    ok = cb(ctx->id, command, args ? args->str : NULL, &reply, userdata);
+    if (!ok) {
+        error_setg(errp, "Plugin '%s' failed to run '%s'%s%s", name, command,
+                   reply ? ": " : "", reply ? reply : "");
+    } else if (!reply) {
+        error_setg(errp, "Plugin '%s' sent no reply to '%s'", name, command);
+    } else {
+        obj = qobject_from_json(reply, errp);
+        if (!obj) {
+            error_prepend(errp, "Plugin '%s' sent an invalid reply: ", name);
+        }
+    }
+    if (reply) {
+        free_reply(reply);
+    }
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        plugin_ctx_unref__locked(ctx);
+    }
+    if (!obj) {
+        return NULL;
+    }
+
+    res = g_new0(PluginCommandResult, 1);
+    res->reply = obj;
+    return res;
+}
+
+bool qemu_plugin_qmp_event(qemu_plugin_id_t id, const char *event,
+                           const char *data)
+{
+    g_autofree char *name = NULL;
+    struct qemu_plugin_ctx *ctx;
+    QObject *obj = NULL;
+    Error *err = NULL;
+
+    if (data) {
+        obj = qobject_from_json(data, &err);
+        if (!obj) {
+            error_report_err(err);
+            return false;
+        }
+    }
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    name = ctx->qmp_name ? g_strdup(ctx->qmp_name) :
+                           g_path_get_basename(ctx->desc->path);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    qapi_event_send_plugin_event(name, event, obj);
+    qobject_unref(obj);
+    return true;
+}
+#else
+bool qemu_plugin_register_qmp_cmd_cb(qemu_plugin_id_t id, const char *name,
+                                     qemu_plugin_qmp_cmd_cb_t cb,
+                                     qemu_plugin_qmp_free_cb_t free_reply,
+                                     void *userdata)
+{
+    return false;
+}
+
+void plugin_unregister_qmp__locked(struct qemu_plugin_ctx *ctx)
+{
+}
+
+bool qemu_plugin_qmp_event(qemu_plugin_id_t id, const char *event,
+                           const char *data)
+{
+    return false;
+}
+#endif
+
+/*
+ * Plugin vmstate sections
+ *
+ * These go through the legacy save_state/load_state handlers: the plugin
+ * serialises itself into the stream, which is just the section's QEMUFile.
+ */
+#ifndef CONFIG_USER_ONLY
+struct qemu_plugin_vmstate {
+    struct qemu_plugin_ctx *ctx;
+    char *idstr;
+    qemu_plugin_vmstate_save_cb_t save;
+    qemu_plugin_vmstate_load_cb_t load;
+    void *userdata;
+};
+
+static void plugin_vmstate_save(QEMUFile *f, void *opaque)
+{
+    struct qemu_plugin_vmstate *vms = opaque;
+
+    vms->save(vms->ctx->id, (struct qemu_plugin_vmstate_stream *)f,
+              vms->userdata);
+}
+
+static int plugin_vmstate_load(QEMUFile *f, void *opaque, int version_id)
+{
+    struct qemu_plugin_vmstate *vms = opaque;
+    int ret;
+
+    ret = vms->load(vms->ctx->id, (struct qemu_plugin_vmstate_stream *)f,
+                    version_id, vms->userdata);
+    return ret ? ret : qemu_file_get_error(f);
+}
+
+static const SaveVMHandlers plugin_vmstate_handlers = {
+    .save_state = plugin_vmstate_save,
+    .load_state = plugin_vmstate_load,
+};
+
+bool qemu_plugin_register_vmstate(qemu_plugin_id_t id, const char *name,
+                                  int version,
+                                  qemu_plugin_vmstate_save_cb_t save,
+                                  qemu_plugin_vmstate_load_cb_t load,
+                                  void *userdata)
+{
+    struct qemu_plugin_vmstate *vms;
+    struct qemu_plugin_ctx *ctx;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    if (unlikely(ctx->uninstalling)) {
+        return false;
+    }
+    vms = g_new(struct qemu_plugin_vmstate, 1);
+    vms->ctx = ctx;
+    vms->idstr = g_strdup_printf("plugin/%s", name);
+    vms->save = save;
+    vms->load = load;
+    vms->userdata = userdata;
+    if (register_savevm_live(vms->idstr, VMSTATE_INSTANCE_ID_ANY, version,
+                             &plugin_vmstate_handlers, vms)) {
+        g_free(vms->idstr);
+        g_free(vms);
+        return false;
+    }
+    ctx->vmstates = g_slist_prepend(ctx->vmstates, vms);
+    return true;
+}
+
+void plugin_unregister_vmstates__locked(struct qemu_plugin_ctx *ctx)
+{
+    GSList *l;
+
+    for (l = ctx->vmstates; l; l = l->next) {
+        struct qemu_plugin_vmstate *vms = l->data;
+
+        unregister_savevm(NULL, vms->idstr, vms);
+        g_free(vms->idstr);
+        g_free(vms);
+    }
+    g_slist_free(ctx->vmstates);
+    ctx->vmstates = NULL;
+}
+
+void qemu_plugin_vmstate_put(struct qemu_plugin_vmstate_stream *s,
+                             const void *buf, size_t len)
+{
+    qemu_put_buffer((QEMUFile *)s, buf, len);
+}
+
+bool qemu_plugin_vmstate_get(struct qemu_plugin_vmstate_stream *s,
+                             void *buf, size_t len)
+{
+    QEMUFile *f = (QEMUFile *)s;
+
+    return qemu_get_buffer(f, buf, len) == len && !qemu_file_get_error(f);
+}
+
+void qemu_plugin_vmstate_put_u64(struct qemu_plugin_vmstate_stream *s,
+                                 uint64_t val)
+{
+    qemu_put_be64((QEMUFile *)s, val);
+}
+
+uint64_t qemu_plugin_vmstate_get_u64(struct qemu_plugin_vmstate_stream *s)
+{
+    return qemu_get_be64((QEMUFile *)s);
+}
+#else
+bool qemu_plugin_register_vmstate(qemu_plugin_id_t id, const char *name,
+                                  int version,
+                                  qemu_plugin_vmstate_save_cb_t save,
+                                  qemu_plugin_vmstate_load_cb_t load,
+                                  void *userdata)
+{
+    return false;
+}
+
+void plugin_unregister_vmstates__locked(struct qemu_plugin_ctx *ctx)
+{
+}
+
+void qemu_plugin_vmstate_put(struct qemu_plugin_vmstate_stream *s,
+                             const void *buf, size_t len)
+{
+    g_assert_not_reached();
+}
+
+bool qemu_plugin_vmstate_get(struct qemu_plugin_vmstate_stream *s,
+                             void *buf, size_t len)
+{
+    g_assert_not_reached();
+}
+
+void qemu_plugin_vmstate_put_u64(struct qemu_plugin_vmstate_stream *s,
+                                 uint64_t val)
+{
+    g_assert_not_reached();
+}
+
+uint64_t qemu_plugin_vmstate_get_u64(struct qemu_plugin_vmstate_stream *s)
+{
+    g_assert_not_reached();
+}
+#endif
+
+/*
+ * Plugin VM control
+ *
+ * Callbacks usually run in vCPU context without the BQL, where the
+ * machine cannot be stopped or reloaded directly. Reset, pause and exit
+ * go through the same requests the monitor and the guest use. Loading a
+ * snapshot needs the BQL and a stopped machine, so it is deferred to a
+ * bottom half in the main loop, where it runs like loadvm.
+ */
+#ifndef CONFIG_USER_ONLY
+struct qemu_plugin_vm_snapshot_request {
+    qemu_plugin_id_t id;
+    char *name;
+    qemu_plugin_vm_snapshot_cb_t cb;
+    void *userdata;
+};
+
+static bool plugin_vm_snapshot_pending;
+
+bool qemu_plugin_vm_request_reset(void)
+{
+    qemu_system_reset_request(SHUTDOWN_CAUSE_HOST_PLUGIN);
+    cpu_stop_current();
+    return true;
+}
+
+bool qemu_plugin_vm_request_pause(void)
+{
+    qemu_system_vmstop_request_prepare();
+    qemu_system_vmstop_request(RUN_STATE_PAUSED);
+    cpu_stop_current();
+    return true;
+}
+
+bool qemu_plugin_vm_request_exit(int exit_code)
+{
+    qemu_system_shutdown_request_with_code(SHUTDOWN_CAUSE_HOST_PLUGIN,
+                                           exit_code);
+    cpu_stop_current();
+    return true;
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void plugin_vm_load_snapshot_bh(void *opaque)
+{
+    struct qemu_plugin_vm_snapshot_request *req = opaque;
+    bool saved_vm_running = runstate_is_running();
+    Error *err = NULL;
+    bool ok;
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+    ok = load_snapshot(req->name, NULL, false, NULL, &err);
+    if (!ok) {
+        error_report_err(err);
+    }
+    qatomic_set(&plugin_vm_snapshot_pending, false);
+
+    if (req->cb) {
+        struct qemu_plugin_ctx *ctx;
+
+        qemu_rec_mutex_lock(&plugin.lock);
+        ctx = g_hash_table_lookup(plugin.id_ht, &req->id) ?
+              plugin_id_to_ctx_locked(req->id) : NULL;
+        if (ctx && !ctx->uninstalling) {
+            req->cb(req->id, ok, req->userdata);
+        }
+        qemu_rec_mutex_unlock(&plugin.lock);
+    }
+    if (ok && saved_vm_running) {
+        vm_start();
+    }
+
+    g_free(req->name);
+    g_free(req);
+}
+
+bool qemu_plugin_vm_request_load_snapshot(qemu_plugin_id_t id,
+                                          const char *name,
+                                          qemu_plugin_vm_snapshot_cb_t cb,
+                                          void *userdata)
+{
+    struct qemu_plugin_vm_snapshot_request *req;
+
+    if (qatomic_xchg(&plugin_vm_snapshot_pending, true)) {
+        return false;
+    }
+
+    req = g_new(struct qemu_plugin_vm_snapshot_request, 1);
+    req->id = id;
+    req->name = g_strdup(name);
+    req->cb = cb;
+    req->userdata = userdata;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            plugin_vm_load_snapshot_bh, req);
+    cpu_stop_current();
+    return true;
+}
+#else
+bool qemu_plugin_vm_request_reset(void)
+{
+    return false;
+}
+
+bool qemu_plugin_vm_request_pause(void)
+{
+    return false;
+}
+
+bool qemu_plugin_vm_request_exit(int exit_code)
+{
+    return false;
+}
+
+bool qemu_plugin_vm_request_load_snapshot(qemu_plugin_id_t id,
+                                          const char *name,
+                                          qemu_plugin_vm_snapshot_cb_t cb,
+                                          void *userdata)
+{
+    return false;
+}
+#endif
+
+void qemu_plugin_atexit_cb(void)
+{
+    plugin_mem_trace_flush_all();
+    plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
+}
+
+/*
+ * Run the atexit callback of @ctx on its own, when it is unloaded while
+ * QEMU keeps running. As at exit its memory traces are flushed first.
+ *
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_atexit__locked(struct qemu_plugin_ctx *ctx)
+{
+    struct qemu_plugin_cb *cb = ctx->callbacks[QEMU_PLUGIN_EV_ATEXIT];
+
+    plugin_mem_trace_flush_ctx__locked(ctx);
+    if (cb) {
+        cb->f.udata(ctx->id, cb->udata);
+    }
 }
 
 void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
@@ -602,7 +1832,12 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    plugin.services = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                            plugin_service_free);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
+    QLIST_INIT(&plugin.mem_traces);
     atexit(qemu_plugin_atexit_cb);
 }
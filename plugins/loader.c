@@ -32,6 +32,8 @@
 #include "exec/tb-flush.h"
 #ifndef CONFIG_USER_ONLY
 #include "hw/boards.h"
+#include "qapi/qapi-commands-misc.h"
+#include "sysemu/cpus.h"
 #endif
 #include "qemu/compiler.h"
 
@@ -168,7 +170,23 @@ static uint64_t xorshift64star(uint64_t x)
     return x * UINT64_C(2685821657736338717);
 }
 
+/* call after having removed @desc from the list */
+static void plugin_desc_free(struct qemu_plugin_desc *desc)
+{
+    int i;
+
+    for (i = 0; i < desc->argc; i++) {
+        g_free(desc->argv[i]);
+    }
+    g_free(desc->argv);
+    g_free(desc->path);
+    g_free(desc);
+}
+
 /*
+ * Load the plugin described by @desc, which must not be on a list. On
+ * success @desc belongs to the plugin, on failure it is freed.
+ *
  * Disable CFI checks.
  * The install and version functions have been loaded from an external library
  * so we do not have type information
@@ -184,6 +202,7 @@ static int plugin_load(struct qemu_plugin_desc *desc, const qemu_info_t *info, E
     ctx = qemu_memalign(qemu_dcache_linesize, sizeof(*ctx));
     memset(ctx, 0, sizeof(*ctx));
     ctx->desc = desc;
+    ctx->refcount = 1;
 
     ctx->handle = g_module_open(desc->path, G_MODULE_BIND_LOCAL);
     if (ctx->handle == NULL) {
@@ -251,7 +270,7 @@ static int plugin_load(struct qemu_plugin_desc *desc, const qemu_info_t *info, E
          * call a full uninstall if the plugin did not yet call it.
          */
         if (!ctx->uninstalling) {
-            plugin_reset_uninstall(ctx->id, NULL, false);
+            plugin_reset_uninstall(ctx->id, NULL, false, false);
         }
     }
 
@@ -262,20 +281,26 @@ static int plugin_load(struct qemu_plugin_desc *desc, const qemu_info_t *info, E
     g_module_close(ctx->handle);
  err_dlopen:
     qemu_vfree(ctx);
+    plugin_desc_free(desc);
     return 1;
 }
 
-/* call after having removed @desc from the list */
-static void plugin_desc_free(struct qemu_plugin_desc *desc)
+static qemu_info_t *plugin_info_new(void)
 {
-    int i;
+    qemu_info_t *info = g_new0(qemu_info_t, 1);
 
-    for (i = 0; i < desc->argc; i++) {
-        g_free(desc->argv[i]);
-    }
-    g_free(desc->argv);
-    g_free(desc->path);
-    g_free(desc);
+    info->target_name = TARGET_NAME;
+    info->version.min = QEMU_PLUGIN_MIN_VERSION;
+    info->version.cur = QEMU_PLUGIN_VERSION;
+#ifndef CONFIG_USER_ONLY
+    MachineState *ms = MACHINE(qdev_get_machine());
+    info->system_emulation = true;
+    info->system.smp_vcpus = ms->smp.cpus;
+    info->system.max_vcpus = ms->smp.max_cpus;
+#else
+    info->system_emulation = false;
+#endif
+    return info;
 }
 
 /**
@@ -284,42 +309,50 @@ static void plugin_desc_free(struct qemu_plugin_desc *desc)
  *
  * Returns 0 if all plugins in the list are installed, !0 otherwise.
  *
- * Note: the descriptor of each successfully installed plugin is removed
- * from the list given by @head.
+ * Note: the descriptor of each plugin is removed from the list given by
+ * @head before it is loaded.
  */
 int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
 {
     struct qemu_plugin_desc *desc, *next;
-    g_autofree qemu_info_t *info = g_new0(qemu_info_t, 1);
-
-    info->target_name = TARGET_NAME;
-    info->version.min = QEMU_PLUGIN_MIN_VERSION;
-    info->version.cur = QEMU_PLUGIN_VERSION;
-#ifndef CONFIG_USER_ONLY
-    MachineState *ms = MACHINE(qdev_get_machine());
-    info->system_emulation = true;
-    info->system.smp_vcpus = ms->smp.cpus;
-    info->system.max_vcpus = ms->smp.max_cpus;
-#else
-    info->system_emulation = false;
-#endif
+    g_autofree qemu_info_t *info = plugin_info_new();
 
     QTAILQ_FOREACH_SAFE(desc, head, entry, next) {
         int err;
 
+        QTAILQ_REMOVE(head, desc, entry);
         err = plugin_load(desc, info, errp);
         if (err) {
             return err;
         }
-        QTAILQ_REMOVE(head, desc, entry);
     }
     return 0;
 }
 
+/*
+ * Drop a reference to @ctx. The installed plugin holds one until it is
+ * uninstalled, so the module is closed once it is uninstalled and no
+ * caller of its code still runs without plugin.lock.
+ */
+void plugin_ctx_unref__locked(struct qemu_plugin_ctx *ctx)
+{
+    g_assert(ctx->refcount > 0);
+    if (--ctx->refcount) {
+        return;
+    }
+    if (!g_module_close(ctx->handle)) {
+        warn_report("%s: %s", __func__, g_module_error());
+    }
+    plugin_desc_free(ctx->desc);
+    qemu_vfree(ctx);
+}
+
 struct qemu_plugin_reset_data {
     struct qemu_plugin_ctx *ctx;
     qemu_plugin_simple_cb_t cb;
     bool reset;
+    /* run the plugin's atexit callback before uninstalling it */
+    bool atexit;
 };
 
 static void plugin_reset_destroy__locked(struct qemu_plugin_reset_data *data)
@@ -328,6 +361,10 @@ static void plugin_reset_destroy__locked(struct qemu_plugin_reset_data *data)
     enum qemu_plugin_event ev;
     bool success;
 
+    if (data->atexit) {
+        plugin_atexit__locked(ctx);
+    }
+
     /*
      * After updating the subscription lists there is no need to wait for an RCU
      * grace period to elapse, because right now we either are in a "safe async"
@@ -356,17 +393,18 @@ static void plugin_reset_destroy__locked(struct qemu_plugin_reset_data *data)
         abort();
     }
 
+    plugin_unregister_services__locked(ctx);
+    plugin_unregister_vmstates__locked(ctx);
+    plugin_unregister_qmp__locked(ctx);
+    plugin_unregister_filters__locked(ctx);
+    plugin_unregister_mem_traces__locked(ctx);
     success = g_hash_table_remove(plugin.id_ht, &ctx->id);
     g_assert(success);
     QTAILQ_REMOVE(&plugin.ctxs, ctx, entry);
     if (data->cb) {
         data->cb(ctx->id);
     }
-    if (!g_module_close(ctx->handle)) {
-        warn_report("%s: %s", __func__, g_module_error());
-    }
-    plugin_desc_free(ctx->desc);
-    qemu_vfree(ctx);
+    plugin_ctx_unref__locked(ctx);
     g_free(data);
 }
 
@@ -374,7 +412,7 @@ static void plugin_reset_destroy(struct qemu_plugin_reset_data *data)
 {
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_reset_destroy__locked(data);
-    qemu_rec_mutex_lock(&plugin.lock);
+    qemu_rec_mutex_unlock(&plugin.lock);
 }
 
 static void plugin_flush_destroy(CPUState *cpu, run_on_cpu_data arg)
@@ -388,16 +426,23 @@ static void plugin_flush_destroy(CPUState *cpu, run_on_cpu_data arg)
 
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
-                            bool reset)
+                            bool reset, bool atexit)
 {
     struct qemu_plugin_reset_data *data;
-    struct qemu_plugin_ctx *ctx;
+    struct qemu_plugin_ctx *ctx, *user;
+    CPUState *cpu = current_cpu ? current_cpu : first_cpu;
 
     WITH_QEMU_LOCK_GUARD(&plugin.lock) {
         ctx = plugin_id_to_ctx_locked(id);
         if (ctx->uninstalling || (reset && ctx->resetting)) {
             return;
         }
+        user = reset ? NULL : plugin_service_user__locked(ctx);
+        if (user) {
+            error_report("plugin: cannot uninstall %s, its services are "
+                         "used by %s", ctx->desc->path, user->desc->path);
+            return;
+        }
         ctx->resetting = reset;
         ctx->uninstalling = !reset;
     }
@@ -406,18 +451,94 @@ void plugin_reset_uninstall(qemu_plugin_id_t id,
     data->ctx = ctx;
     data->cb = cb;
     data->reset = reset;
+    data->atexit = atexit;
     /*
-     * Only flush the code cache if the vCPUs have been created. If so,
-     * current_cpu must be non-NULL.
+     * Only flush the code cache if the vCPUs have been created. The
+     * request comes from a vCPU, or from the monitor when unloading a
+     * plugin at run time.
      */
-    if (current_cpu) {
-        async_safe_run_on_cpu(current_cpu, plugin_flush_destroy,
+    if (cpu && cpu->created) {
+        async_safe_run_on_cpu(cpu, plugin_flush_destroy,
                               RUN_ON_CPU_HOST_PTR(data));
     } else {
         /*
-         * If current_cpu isn't set, then we don't have yet any vCPU threads
-         * and we therefore can remove the callbacks synchronously.
+         * If there are no vCPU threads yet, we can remove the callbacks
+         * synchronously.
          */
         plugin_reset_destroy(data);
     }
 }
+
+#ifndef CONFIG_USER_ONLY
+static struct qemu_plugin_ctx *plugin_find_ctx__locked(const char *path)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (!ctx->uninstalling && strcmp(ctx->desc->path, path) == 0) {
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The vCPUs are paused while the plugin installs, so that it can
+ * register callbacks and filters as it would at startup. Code translated
+ * before is not instrumented, hence the flush.
+ */
+void qmp_plugin_load(const char *file, bool has_args, strList *args,
+                     Error **errp)
+{
+    g_autofree qemu_info_t *info = plugin_info_new();
+    struct qemu_plugin_desc *desc;
+    strList *l;
+
+    desc = g_new0(struct qemu_plugin_desc, 1);
+    desc->path = g_strdup(file);
+    for (l = args; l; l = l->next) {
+        desc->argc++;
+        desc->argv = g_realloc_n(desc->argv, desc->argc, sizeof(char *));
+        desc->argv[desc->argc - 1] = g_strdup(l->value);
+    }
+
+    /* vCPUs may wait for the plugin lock, so pause them before taking it */
+    pause_all_vcpus();
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        if (plugin_find_ctx__locked(file)) {
+            error_setg(errp, "Plugin %s is already loaded", file);
+            plugin_desc_free(desc);
+        } else if (plugin_load(desc, info, errp) == 0) {
+            plugin_vcpu_init_replay__locked(plugin_find_ctx__locked(file));
+            if (first_cpu) {
+                tb_flush(first_cpu);
+            }
+        }
+    }
+    resume_all_vcpus();
+}
+
+void qmp_plugin_unload(const char *file, Error **errp)
+{
+    struct qemu_plugin_ctx *ctx, *user;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_find_ctx__locked(file);
+    if (!ctx) {
+        error_setg(errp, "Plugin %s is not loaded", file);
+        return;
+    }
+    user = plugin_service_user__locked(ctx);
+    if (user) {
+        error_setg(errp, "Plugin %s provides services used by %s, unload it "
+                   "first", file, user->desc->path);
+        return;
+    }
+    /*
+     * The plugin is gone once all vCPUs have left its translated code. It
+     * sees the same atexit callback as when QEMU exits, to report its
+     * results and release what it allocated through the API.
+     */
+    plugin_reset_uninstall(ctx->id, NULL, false, true);
+}
+#endif
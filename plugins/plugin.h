@@ -45,6 +45,21 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* services published by plugins, keyed by name */
+    GHashTable *services;
+    /* all live scoreboards, each holding scoreboard_alloc_size slots */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_alloc_size;
+    /* all memory traces, each freed with the plugin that created it */
+    QLIST_HEAD(, qemu_plugin_mem_trace) mem_traces;
+    /* set once the symbols of the translation filters have been looked up */
+    bool filters_resolved;
+};
+
+/* a [start, end) range of guest virtual addresses */
+struct qemu_plugin_pc_range {
+    uint64_t start;
+    uint64_t end;
 };
 
 
@@ -58,6 +73,23 @@ struct qemu_plugin_ctx {
      * to strdup plugin args.
      */
     struct qemu_plugin_desc *desc;
+    /* vmstate sections registered by the plugin */
+    GSList *vmstates;
+    /* plugin-command handler, see qemu_plugin_register_qmp_cmd_cb() */
+    char *qmp_name;
+    qemu_plugin_qmp_cmd_cb_t qmp_cb;
+    qemu_plugin_qmp_free_cb_t qmp_free_reply;
+    void *qmp_userdata;
+    /*
+     * Translation filter: NULL @filter_ranges means any PC, 0 in
+     * @filter_mmu_idx any MMU index. @filter_symbols holds the symbols
+     * still to be added to @filter_ranges.
+     */
+    GArray *filter_ranges;
+    GPtrArray *filter_symbols;
+    uint64_t filter_mmu_idx;
+    /* the plugin itself, plus callers of its code not holding the lock */
+    unsigned int refcount;
     bool installing;
     bool uninstalling;
     bool resetting;
@@ -65,6 +97,8 @@ struct qemu_plugin_ctx {
 
 struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id);
 
+void plugin_ctx_unref__locked(struct qemu_plugin_ctx *ctx);
+
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
                                enum qemu_plugin_op op, void *ptr,
@@ -72,7 +106,7 @@ void plugin_register_inline_op(GArray **arr,
 
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
-                            bool reset);
+                            bool reset, bool atexit);
 
 void plugin_register_cb(qemu_plugin_id_t id, enum qemu_plugin_event ev,
                         void *func);
@@ -80,6 +114,23 @@ void plugin_register_cb(qemu_plugin_id_t id, enum qemu_plugin_event ev,
 void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
                                   enum qemu_plugin_event ev);
 
+void plugin_unregister_services__locked(struct qemu_plugin_ctx *ctx);
+
+struct qemu_plugin_ctx *
+plugin_service_user__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_unregister_vmstates__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_unregister_qmp__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_unregister_filters__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_unregister_mem_traces__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_atexit__locked(struct qemu_plugin_ctx *ctx);
+
+void plugin_vcpu_init_replay__locked(struct qemu_plugin_ctx *ctx);
+
 void
 plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
                          void *func, void *udata);
@@ -89,6 +140,14 @@ plugin_register_dyn_cb__udata(GArray **arr,
                               qemu_plugin_vcpu_udata_cb_t cb,
                               enum qemu_plugin_cb_flags flags, void *udata);
 
+void
+plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   enum qemu_plugin_cond cond,
+                                   qemu_plugin_u64 entry,
+                                   uint64_t add, uint64_t imm,
+                                   void *udata);
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
@@ -96,6 +155,16 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void plugin_register_vcpu_mem_trace(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    struct qemu_plugin_mem_trace *trace);
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index);
 
 #endif /* PLUGIN_H */
@@ -185,6 +185,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-profile=file (pre-warm the TCG cache from a recorded profile, system emulation only)\n"
+    "                tb-speculate=on|off (translate ahead on idle vCPUs, system emulation only)\n"
+    "                tier-threshold=n (retranslate TCG blocks run n times, RISC-V only)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -227,6 +230,48 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-profile=file``
+        Records the translation blocks still in the TCG cache to
+        ``file`` when QEMU exits, and translates them again ahead of
+        execution when the next run starts, a few at a time whenever a
+        vCPU enters its execution loop, skipping those whose code is no
+        longer mapped at the same place or has changed. After a flush
+        of the translation cache, the blocks the vCPUs had run most
+        recently are translated again the same way. Only the keys of
+        the blocks are saved, not the generated code, so this pre-warms
+        the translation cache rather than persisting it: every block is
+        still translated at startup, only earlier than the guest would
+        otherwise need it. This is most useful together with
+        ``-loadvm``, when the restored guest runs the code it ran when
+        the profile was recorded. The file is ignored if it was written
+        by a different QEMU version or target. Looking up the blocks of
+        the file walks the guest page tables, which on some targets
+        (e.g. RISC-V) marks the pages as accessed even if the guest does
+        not run them; the blocks requeued after a flush are only
+        translated if their pages are still in the TLB. System emulation
+        only.
+
+    ``tb-speculate=on|off``
+        Lets halted vCPUs translate code before the guest needs it: the
+        targets of direct jumps out of recently run translation blocks,
+        and, after the translation cache has been flushed, the blocks
+        the vCPUs had run most recently. Only code on pages already in
+        the TLB is translated, so the guest page tables are never
+        walked for it. Only takes effect with ``thread=multi``, where
+        each vCPU has its own host thread, and is ignored with icount or
+        record/replay, which must not depend on host timing. System
+        emulation only.
+
+    ``tier-threshold=n``
+        Counts the executions of each translation block and, once a
+        block has run n times, translates its code again as a
+        superblock: forward jumps within the page are followed instead
+        of ending the block, so that the code on both sides is
+        optimized together. With ``thread=multi`` the counts are
+        approximate, as vCPUs do not synchronize to update them. TCG
+        plugins see the superblock translated like any other block. The
+        default of 0 disables the counters. RISC-V only.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
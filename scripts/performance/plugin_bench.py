@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+#  Measure the cost of each style of plugin instrumentation.
+#  Syntax:
+#  plugin_bench.py [-h] [-r REPEAT] [-m MODE] -p LIBBENCH -q QEMU \
+#           <kernel> [<kernel> ...]
+#
+#  [-h] - Print the script arguments help message.
+#  [-r] - Number of runs per configuration; the fastest one is kept,
+#         and the standard deviation of all of them is reported.
+#       - If this flag is not specified, the tool defaults to 5.
+#  [-m] - Instrumentation mode of tests/plugin/bench.c to measure; may be
+#         given several times. Defaults to every mode.
+#  -p   - Path to libbench.so.
+#  -q   - Path to the system emulator, e.g. qemu-system-riscv64.
+#
+#  Each kernel is a bare-metal test that exits through semihosting, such
+#  as the ones built for tests/tcg/riscv64 softmmu. Every kernel is run
+#  without a plugin, then with the bench plugin in each mode. The time
+#  over the uninstrumented run is divided by the number of events the
+#  mode instruments, giving ns per instruction or ns per memory access.
+#  The event counts come from the inline modes, which count exactly, so
+#  mode=none gives the cost of the translation callback per instruction.
+#  A difference below the standard deviations of the two configurations
+#  is noise.
+#
+#  The results are printed as one JSON object per kernel and mode.
+#
+#  Example of usage:
+#  plugin_bench.py -p build/tests/plugin/libbench.so \
+#      -q build/qemu-system-riscv64 \
+#      build/tests/tcg/riscv64-softmmu/bench-mem
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+MODES = ['none', 'udata', 'inline', 'mem', 'mem-inline', 'hwaddr', 'read']
+
+# The event each mode instruments
+MODE_EVENTS = {
+    'none': 'insns',
+    'udata': 'insns',
+    'inline': 'insns',
+    'mem': 'accesses',
+    'mem-inline': 'accesses',
+    'hwaddr': 'accesses',
+    'read': 'insns',
+}
+
+QEMU_OPTS = ['-M', 'virt', '-display', 'none', '-semihosting',
+             '-monitor', 'none', '-serial', 'none']
+
+
+def run_qemu(qemu, kernel, plugin=None, mode=None):
+    """Run @kernel once; return the wall time and the plugin's report."""
+    cmd = [qemu] + QEMU_OPTS + ['-device', 'loader,file=' + kernel]
+    with tempfile.TemporaryDirectory() as tmpdir:
+        log = os.path.join(tmpdir, 'plugin.log')
+        if plugin:
+            cmd += ['-plugin', plugin + ',mode=' + mode,
+                    '-d', 'plugin', '-D', log]
+        start = time.perf_counter()
+        proc = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.PIPE)
+        elapsed = time.perf_counter() - start
+        if proc.returncode:
+            sys.exit('{} failed:\n{}'.format(' '.join(cmd),
+                                             proc.stderr.decode('utf-8')))
+        report = {}
+        if plugin:
+            with open(log, encoding='utf-8') as f:
+                for line in f:
+                    if line.startswith('bench:'):
+                        for field in line.split()[1:]:
+                            key, value = field.split('=', 1)
+                            report[key] = value
+            if not report:
+                sys.exit('no report from the bench plugin in ' + log)
+    return elapsed, report
+
+
+def best_of(repeat, *args):
+    """Run the configuration @repeat times; return the fastest run and
+    the standard deviation of the wall times."""
+    runs = [run_qemu(*args) for _ in range(repeat)]
+    elapsed, report = min(runs, key=lambda run: run[0])
+    stdev = statistics.stdev([run[0] for run in runs]) if repeat > 1 else 0
+    return elapsed, report, stdev
+
+
+# Parse the command line arguments
+parser = argparse.ArgumentParser(
+    usage='plugin_bench.py [-h] [-r REPEAT] [-m MODE] -p LIBBENCH -q QEMU '
+          '<kernel> [<kernel> ...]')
+
+parser.add_argument('-r', dest='repeat', type=int, default=5,
+                    help='Number of runs per configuration.')
+parser.add_argument('-m', dest='modes', action='append', choices=MODES,
+                    help='Instrumentation mode to measure.')
+parser.add_argument('-p', dest='plugin', required=True,
+                    help='Path to libbench.so.')
+parser.add_argument('-q', dest='qemu', required=True,
+                    help='Path to the system emulator.')
+parser.add_argument('kernels', nargs='+', help='Guest kernels to run.')
+
+args = parser.parse_args()
+
+for kernel in args.kernels:
+    base, _, base_stdev = best_of(args.repeat, args.qemu, kernel)
+    # the inline modes count every instruction and access exactly
+    counts = {
+        'insns': int(run_qemu(args.qemu, kernel, args.plugin,
+                              'inline')[1]['insns']),
+        'accesses': int(run_qemu(args.qemu, kernel, args.plugin,
+                                 'mem-inline')[1]['accesses']),
+    }
+    for mode in args.modes or MODES:
+        elapsed, report, stdev = best_of(args.repeat, args.qemu, kernel,
+                                         args.plugin, mode)
+        event = MODE_EVENTS[mode]
+        events = counts[event]
+        result = {
+            'kernel': os.path.basename(kernel),
+            'mode': mode,
+            'base_s': round(base, 6),
+            'base_stdev_s': round(base_stdev, 6),
+            'time_s': round(elapsed, 6),
+            'time_stdev_s': round(stdev, 6),
+            'insns': counts['insns'],
+            'accesses': counts['accesses'],
+            'event': event,
+            'ns_per_event': (round((elapsed - base) * 1e9 / events, 3)
+                             if events else None),
+        }
+        if int(report.get('read_failures', 0)):
+            result['read_failures'] = int(report['read_failures'])
+        print(json.dumps(result), flush=True)
@@ -554,6 +554,25 @@ static void gen_set_fpr_d(DisasContext *ctx, int reg_num, TCGv_i64 t)
     }
 }
 
+/*
+ * In a tier 2 TB, i.e. one hot enough to have been retranslated, follow
+ * a forward jump within the page and keep translating at its target, so
+ * that the blocks on either side are optimized as one.
+ */
+static bool gen_fold_jump(DisasContext *ctx, target_long diff)
+{
+    target_ulong dest = ctx->base.pc_next + diff;
+
+    if (!(tb_cflags(ctx->base.tb) & CF_TIER2) || diff <= 0 ||
+        ctx->itrigger || !is_same_page(&ctx->base, dest)) {
+        return false;
+    }
+
+    /* translate_insn advances pc_next past the jump */
+    ctx->base.pc_next = dest - ctx->cur_insn_len;
+    return true;
+}
+
 static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
 {
     TCGv succ_pc = dest_gpr(ctx, rd);
@@ -571,6 +590,9 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    if (gen_fold_jump(ctx, imm)) {
+        return;
+    }
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
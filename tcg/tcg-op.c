@@ -283,7 +283,11 @@ static void add_last_as_label_use(TCGLabel *l)
 {
     TCGLabelUse *u = tcg_malloc(sizeof(TCGLabelUse));
 
-    u->op = tcg_last_op();
+    if (tcg_ctx->emit_before_op) {
+        u->op = QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    } else {
+        u->op = tcg_last_op();
+    }
     QSIMPLEQ_INSERT_TAIL(&l->branches, u, next);
 }
 
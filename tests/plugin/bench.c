@@ -0,0 +1,194 @@
+/*
+ * Exercise one style of instrumentation, for measuring its cost.
+ *
+ * The plugin instruments every instruction or every memory access with
+ * the style selected by mode= and counts the events it sees. At exit it
+ * prints a single line of key=value pairs, which
+ * scripts/performance/plugin_bench.py combines with the run time to
+ * compute a cost per event:
+ *
+ *   mode=none       translation callback only
+ *   mode=udata      one udata callback per instruction
+ *   mode=inline     one per-vCPU inline add per instruction
+ *   mode=mem        one callback per memory access
+ *   mode=mem-inline one per-vCPU inline add per memory access
+ *   mode=hwaddr     memory callback resolving the physical address
+ *   mode=read       udata callback reading the instruction from memory
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+enum bench_mode {
+    BENCH_NONE,
+    BENCH_UDATA,
+    BENCH_INLINE,
+    BENCH_MEM,
+    BENCH_MEM_INLINE,
+    BENCH_HWADDR,
+    BENCH_READ,
+};
+
+static const char *mode_names[] = {
+    [BENCH_NONE] = "none",
+    [BENCH_UDATA] = "udata",
+    [BENCH_INLINE] = "inline",
+    [BENCH_MEM] = "mem",
+    [BENCH_MEM_INLINE] = "mem-inline",
+    [BENCH_HWADDR] = "hwaddr",
+    [BENCH_READ] = "read",
+};
+
+typedef struct {
+    uint64_t insns;
+    uint64_t accesses;
+    /* keeps the results of hwaddr and read lookups alive */
+    uint64_t sink;
+} BenchCount;
+
+static enum bench_mode mode = BENCH_UDATA;
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 insns;
+static qemu_plugin_u64 accesses;
+static qemu_plugin_u64 sink;
+static uint64_t read_failures;
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(insns, cpu_index, 1);
+}
+
+static void vcpu_insn_read(unsigned int cpu_index, void *udata)
+{
+    uint64_t vaddr = (uintptr_t)udata;
+    uint32_t opcode;
+
+    if (qemu_plugin_read_memory_vaddr(vaddr, (uint8_t *)&opcode,
+                                      sizeof(opcode))) {
+        qemu_plugin_u64_add(sink, cpu_index, opcode);
+    } else {
+        __atomic_fetch_add(&read_failures, 1, __ATOMIC_RELAXED);
+    }
+    qemu_plugin_u64_add(insns, cpu_index, 1);
+}
+
+static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
+                     uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(accesses, cpu_index, 1);
+}
+
+static void vcpu_mem_hwaddr(unsigned int cpu_index,
+                            qemu_plugin_meminfo_t meminfo,
+                            uint64_t vaddr, void *udata)
+{
+    struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(meminfo, vaddr);
+
+    if (hwaddr && !qemu_plugin_hwaddr_is_io(hwaddr)) {
+        qemu_plugin_u64_add(sink, cpu_index,
+                            qemu_plugin_hwaddr_phys_addr(hwaddr));
+    }
+    qemu_plugin_u64_add(accesses, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+
+    for (size_t i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        uint64_t vaddr = qemu_plugin_insn_vaddr(insn);
+
+        switch (mode) {
+        case BENCH_NONE:
+            break;
+        case BENCH_UDATA:
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   NULL);
+            break;
+        case BENCH_INLINE:
+            qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+                insn, QEMU_PLUGIN_INLINE_ADD_U64, insns, 1);
+            break;
+        case BENCH_MEM:
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             QEMU_PLUGIN_MEM_RW, NULL);
+            break;
+        case BENCH_MEM_INLINE:
+            qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+                insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+                accesses, 1);
+            break;
+        case BENCH_HWADDR:
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_hwaddr,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             QEMU_PLUGIN_MEM_RW, NULL);
+            break;
+        case BENCH_READ:
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_read,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   (void *)(uintptr_t)vaddr);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autofree gchar *out = g_strdup_printf(
+        "bench: mode=%s insns=%" PRIu64 " accesses=%" PRIu64
+        " read_failures=%" PRIu64 " sink=%" PRIu64 "\n",
+        mode_names[mode], qemu_plugin_u64_sum(insns),
+        qemu_plugin_u64_sum(accesses), read_failures,
+        qemu_plugin_u64_sum(sink));
+
+    qemu_plugin_outs(out);
+    qemu_plugin_scoreboard_free(counts);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+        bool found = false;
+
+        if (g_strcmp0(tokens[0], "mode") != 0) {
+            fprintf(stderr, "unsupported argument: %s\n", opt);
+            return -1;
+        }
+        for (int m = 0; m < G_N_ELEMENTS(mode_names); m++) {
+            if (g_strcmp0(tokens[1], mode_names[m]) == 0) {
+                mode = m;
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "unknown mode: %s\n", opt);
+            return -1;
+        }
+    }
+
+    counts = qemu_plugin_scoreboard_new(sizeof(BenchCount));
+    insns = qemu_plugin_scoreboard_u64_in_struct(counts, BenchCount, insns);
+    accesses = qemu_plugin_scoreboard_u64_in_struct(counts, BenchCount,
+                                                    accesses);
+    sink = qemu_plugin_scoreboard_u64_in_struct(counts, BenchCount, sink);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Check that conditional callbacks fire as often as the per-vCPU inline
+ * counts of the same events say they should.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t tb_count_inline;
+    uint64_t tb_always;
+    uint64_t tb_never;
+    uint64_t tb_lt;
+    uint64_t tb_lt_fired;
+    uint64_t insn_count_inline;
+    uint64_t insn_period;
+    uint64_t insn_period_fired;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_count_inline;
+static qemu_plugin_u64 tb_always;
+static qemu_plugin_u64 tb_never;
+static qemu_plugin_u64 tb_lt;
+static qemu_plugin_u64 tb_lt_fired;
+static qemu_plugin_u64 insn_count_inline;
+static qemu_plugin_u64 insn_period;
+static qemu_plugin_u64 insn_period_fired;
+
+/* the instruction callback fires on every period-th instruction */
+static uint64_t period = 7;
+
+static void check_count(GString *out, const char *name,
+                        uint64_t expected, uint64_t got)
+{
+    g_string_append_printf(out, "%s: %" PRIu64 " (expected: %" PRIu64 ")\n",
+                           name, got, expected);
+    g_assert(got == expected);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) out = g_string_new("");
+    uint64_t tbs = qemu_plugin_u64_sum(tb_count_inline);
+    uint64_t insns = qemu_plugin_u64_sum(insn_count_inline);
+
+    check_count(out, "tb always", tbs, qemu_plugin_u64_sum(tb_always));
+    check_count(out, "tb never", tbs, qemu_plugin_u64_sum(tb_never));
+    check_count(out, "tb lt", 0, qemu_plugin_u64_sum(tb_lt_fired));
+    /* the callback resets the counter, which keeps the remainder */
+    check_count(out, "insn period", insns,
+                qemu_plugin_u64_sum(insn_period_fired) * period +
+                qemu_plugin_u64_sum(insn_period));
+    qemu_plugin_outs(out->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_always(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_always, cpu_index, 1);
+}
+
+static void vcpu_tb_lt(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_lt_fired, cpu_index, 1);
+}
+
+static void vcpu_insn_period(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_set(insn_period, cpu_index, 0);
+    qemu_plugin_u64_add(insn_period_fired, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_count_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_always, QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_COND_ALWAYS,
+        tb_always, 0, 0, NULL);
+    /* a counter that is only ever updated inline */
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, NULL, QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_COND_NEVER,
+        tb_never, 1, 0, NULL);
+    /* the counter is at least 1 once updated, so this never fires */
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_lt, QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_COND_LT,
+        tb_lt, 1, 1, NULL);
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_count_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_insn_period, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_EQ, insn_period, 1, period, NULL);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "period") == 0 && tokens[1]) {
+            period = g_ascii_strtoull(tokens[1], NULL, 0);
+            if (period == 0) {
+                fprintf(stderr, "cond: period must be positive\n");
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "cond: unknown option: %s\n", opt);
+            return -1;
+        }
+    }
+
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_count_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                           tb_count_inline);
+    tb_always = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     tb_always);
+    tb_never = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                    tb_never);
+    tb_lt = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb_lt);
+    tb_lt_fired = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       tb_lt_fired);
+    insn_count_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_count_inline);
+    insn_period = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       insn_period);
+    insn_period_fired = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_period_fired);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Count the interrupts and exceptions taken by each vCPU.
+ *
+ * With print=on every discontinuity is logged as it happens instead.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    enum qemu_plugin_discon_type type;
+    uint64_t cause;
+    uint64_t count;
+} DisconStats;
+
+static GMutex lock;
+/* per cause statistics, for interrupts and exceptions respectively */
+static GHashTable *statistics[2];
+static bool do_print;
+
+static const char *type_name(enum qemu_plugin_discon_type type)
+{
+    return type == QEMU_PLUGIN_DISCON_INTERRUPT ? "interrupt" : "exception";
+}
+
+static void vcpu_discon(qemu_plugin_id_t id, unsigned int vcpu_index,
+                        enum qemu_plugin_discon_type type, uint64_t cause,
+                        uint64_t from_pc, uint64_t to_pc)
+{
+    /* the cause must be the one delivered, not the "no exception" marker */
+    g_assert(cause != (uint64_t)-1);
+
+    if (do_print) {
+        g_autofree gchar *out = g_strdup_printf(
+            "cpu %u: %s %#" PRIx64 " from 0x%" PRIx64 " to 0x%" PRIx64 "\n",
+            vcpu_index, type_name(type), cause, from_pc, to_pc);
+        qemu_plugin_outs(out);
+    } else {
+        GHashTable *table =
+            statistics[type == QEMU_PLUGIN_DISCON_INTERRUPT ? 0 : 1];
+        DisconStats *entry;
+
+        g_mutex_lock(&lock);
+        entry = g_hash_table_lookup(table, &cause);
+        if (!entry) {
+            entry = g_new0(DisconStats, 1);
+            entry->type = type;
+            entry->cause = cause;
+            g_hash_table_insert(table, &entry->cause, entry);
+        }
+        entry->count++;
+        g_mutex_unlock(&lock);
+    }
+}
+
+static gint comp_func(gconstpointer ea, gconstpointer eb)
+{
+    const DisconStats *a = ea, *b = eb;
+
+    return a->count > b->count ? -1 : 1;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = NULL;
+    GList *entries = NULL, *it;
+
+    if (do_print) {
+        return;
+    }
+
+    report = g_string_new("type       cause              count\n");
+    g_mutex_lock(&lock);
+    for (int i = 0; i < 2; i++) {
+        entries = g_list_concat(entries,
+                                g_hash_table_get_values(statistics[i]));
+    }
+    entries = g_list_sort(entries, comp_func);
+    for (it = entries; it; it = it->next) {
+        DisconStats *entry = it->data;
+
+        g_string_append_printf(report, "%-10s %#-18" PRIx64 " %" PRIu64 "\n",
+                               type_name(entry->type), entry->cause,
+                               entry->count);
+    }
+    g_list_free(entries);
+    g_mutex_unlock(&lock);
+
+    qemu_plugin_outs(report->str);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "print") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_print)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "unsupported argument: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        statistics[i] = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              NULL, g_free);
+    }
+
+    qemu_plugin_register_vcpu_discon_cb(id, QEMU_PLUGIN_DISCON_ALL,
+                                        vcpu_discon);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
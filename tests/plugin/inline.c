@@ -0,0 +1,120 @@
+/*
+ * Check that per-vCPU inline operations count the same events as the
+ * equivalent callbacks.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t tb_count;
+    uint64_t tb_count_inline;
+    uint64_t insn_count;
+    uint64_t insn_count_inline;
+    uint64_t mem_count;
+    uint64_t mem_count_inline;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_count;
+static qemu_plugin_u64 tb_count_inline;
+static qemu_plugin_u64 insn_count;
+static qemu_plugin_u64 insn_count_inline;
+static qemu_plugin_u64 mem_count;
+static qemu_plugin_u64 mem_count_inline;
+
+static void check_count(GString *out, const char *name,
+                        qemu_plugin_u64 cb, qemu_plugin_u64 inl)
+{
+    uint64_t expected = qemu_plugin_u64_sum(cb);
+    uint64_t got = qemu_plugin_u64_sum(inl);
+
+    g_string_append_printf(out, "%s: %" PRIu64 " (inline: %" PRIu64 ")\n",
+                           name, expected, got);
+    g_assert(got == expected);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) out = g_string_new("");
+
+    check_count(out, "tb", tb_count, tb_count_inline);
+    check_count(out, "insn", insn_count, insn_count_inline);
+    check_count(out, "mem", mem_count, mem_count_inline);
+    qemu_plugin_outs(out->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_count, cpu_index, 1);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(insn_count, cpu_index, 1);
+}
+
+static void vcpu_mem_access(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(mem_count, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_count_inline, 1);
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, NULL);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_count_inline, 1);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_count_inline, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                    tb_count);
+    tb_count_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                           tb_count_inline);
+    insn_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      insn_count);
+    insn_count_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_count_inline);
+    mem_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     mem_count);
+    mem_count_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, mem_count_inline);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
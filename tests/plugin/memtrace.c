@@ -0,0 +1,112 @@
+/*
+ * Check that batched memory traces see the same accesses as the
+ * equivalent callbacks.
+ *
+ * Reads and writes are registered separately on the same trace, so that
+ * an instruction which both loads and stores needs room for all of its
+ * records at once.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t reads_traced;
+    uint64_t writes_traced;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 reads;
+static qemu_plugin_u64 writes;
+static qemu_plugin_u64 reads_traced;
+static qemu_plugin_u64 writes_traced;
+static struct qemu_plugin_mem_trace *trace;
+
+static void check_count(GString *out, const char *name,
+                        qemu_plugin_u64 cb, qemu_plugin_u64 traced)
+{
+    uint64_t expected = qemu_plugin_u64_sum(cb);
+    uint64_t got = qemu_plugin_u64_sum(traced);
+
+    g_string_append_printf(out, "%s: %" PRIu64 " (traced: %" PRIu64 ")\n",
+                           name, expected, got);
+    g_assert(got == expected);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) out = g_string_new("");
+
+    check_count(out, "reads", reads, reads_traced);
+    check_count(out, "writes", writes, writes_traced);
+    qemu_plugin_outs(out->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_mem_access(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    if (qemu_plugin_mem_is_store(info)) {
+        qemu_plugin_u64_add(writes, cpu_index, 1);
+    } else {
+        qemu_plugin_u64_add(reads, cpu_index, 1);
+    }
+}
+
+static void vcpu_mem_trace(unsigned int cpu_index,
+                           const qemu_plugin_mem_record *records,
+                           size_t n, void *udata)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (qemu_plugin_mem_is_store(records[i].info)) {
+            qemu_plugin_u64_add(writes_traced, cpu_index, 1);
+        } else {
+            qemu_plugin_u64_add(reads_traced, cpu_index, 1);
+        }
+    }
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_trace(insn, QEMU_PLUGIN_MEM_R, trace);
+        qemu_plugin_register_vcpu_mem_trace(insn, QEMU_PLUGIN_MEM_W, trace);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    reads = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, reads);
+    writes = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, writes);
+    reads_traced = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                        reads_traced);
+    writes_traced = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                         writes_traced);
+    /* the smallest buffer, so that it fills up often */
+    trace = qemu_plugin_mem_trace_new(id, 0, vcpu_mem_trace, NULL);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Exercise qemu_plugin_write_register().
+ *
+ * Without arguments, only check that buffers that do not match the size
+ * of a register are refused, so that the plugin can run under any test.
+ * With insn=OPCODE,reg=NAME,value=N, write N to the register before
+ * every execution of the instruction encoded as OPCODE, for a guest that
+ * checks it sees the new value. Values are stored least significant byte
+ * first, assuming a little-endian target.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static bool write_mode;
+static uint64_t match_insn;
+static const char *reg_name;
+static uint64_t reg_value;
+
+typedef struct {
+    uint64_t checks;
+    uint64_t writes;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 checks;
+static qemu_plugin_u64 writes;
+
+/*
+ * Find the register to check or write. This has to run on a vCPU as the
+ * register list comes from its gdbstub description; handles are the same
+ * for every vCPU, so the lookup is only done once.
+ */
+static struct qemu_plugin_register *find_register(void)
+{
+    static struct qemu_plugin_register *handle;
+    g_autoptr(GArray) regs = NULL;
+
+    if (handle) {
+        return handle;
+    }
+
+    regs = qemu_plugin_get_registers();
+    g_assert(regs && regs->len > 0);
+    for (int i = 0; i < regs->len; i++) {
+        qemu_plugin_reg_descriptor *rd =
+            &g_array_index(regs, qemu_plugin_reg_descriptor, i);
+
+        if (!reg_name || g_strcmp0(rd->name, reg_name) == 0) {
+            handle = rd->handle;
+            return handle;
+        }
+    }
+    g_error("regwrite: no register named %s", reg_name);
+}
+
+static void vcpu_check(unsigned int cpu_index, void *udata)
+{
+    struct qemu_plugin_register *reg = find_register();
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    int size = qemu_plugin_read_register(reg, buf);
+
+    g_assert(size > 0 && buf->len == size);
+
+    /* one byte short, then one byte too many */
+    g_byte_array_set_size(buf, size - 1);
+    g_assert(qemu_plugin_write_register(reg, buf) == -1);
+    g_byte_array_set_size(buf, size + 1);
+    g_assert(qemu_plugin_write_register(reg, buf) == -1);
+
+    qemu_plugin_u64_add(checks, cpu_index, 1);
+}
+
+static void vcpu_write(unsigned int cpu_index, void *udata)
+{
+    struct qemu_plugin_register *reg = find_register();
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    int size = qemu_plugin_read_register(reg, buf);
+
+    g_assert(size > 0 && size <= sizeof(reg_value));
+    for (int i = 0; i < size; i++) {
+        buf->data[i] = reg_value >> (i * 8);
+    }
+    g_assert(qemu_plugin_write_register(reg, buf) == size);
+
+    qemu_plugin_u64_add(writes, cpu_index, 1);
+}
+
+static uint64_t insn_opcode(struct qemu_plugin_insn *insn)
+{
+    const uint8_t *data = qemu_plugin_insn_data(insn);
+    size_t size = MIN(qemu_plugin_insn_size(insn), sizeof(uint64_t));
+    uint64_t opcode = 0;
+
+    for (int i = 0; i < size; i++) {
+        opcode |= (uint64_t)data[i] << (i * 8);
+    }
+    return opcode;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    if (!write_mode) {
+        qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_check,
+                                             QEMU_PLUGIN_CB_RW_REGS, NULL);
+        return;
+    }
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        if (insn_opcode(insn) == match_insn) {
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_write,
+                                                   QEMU_PLUGIN_CB_RW_REGS,
+                                                   NULL);
+        }
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) out = g_string_new("");
+
+    if (write_mode) {
+        g_string_printf(out, "writes: %" PRIu64 "\n",
+                        qemu_plugin_u64_sum(writes));
+        g_assert(qemu_plugin_u64_sum(writes) > 0);
+    } else {
+        g_string_printf(out, "checks: %" PRIu64 "\n",
+                        qemu_plugin_u64_sum(checks));
+    }
+    qemu_plugin_outs(out->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    bool have_insn = false, have_value = false;
+
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "insn") == 0 && tokens[1]) {
+            match_insn = g_ascii_strtoull(tokens[1], NULL, 0);
+            have_insn = true;
+        } else if (g_strcmp0(tokens[0], "reg") == 0 && tokens[1]) {
+            reg_name = g_strdup(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "value") == 0 && tokens[1]) {
+            reg_value = g_ascii_strtoull(tokens[1], NULL, 0);
+            have_value = true;
+        } else {
+            fprintf(stderr, "regwrite: unknown option: %s\n", opt);
+            return -1;
+        }
+    }
+
+    write_mode = have_insn || have_value || reg_name;
+    if (write_mode && !(have_insn && have_value && reg_name)) {
+        fprintf(stderr, "regwrite: insn, reg and value go together\n");
+        return -1;
+    }
+
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    checks = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, checks);
+    writes = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, writes);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
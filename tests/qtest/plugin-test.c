@@ -0,0 +1,83 @@
+/*
+ * QTest testcase for loading and unloading TCG plugins at run time
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+/*
+ * inline frees a scoreboard and checks its counts in its atexit
+ * callback, memtrace also owns a memory trace.
+ */
+static const char *const plugins[] = { "libinline.so", "libmemtrace.so" };
+
+static char *plugin_path(const char *name)
+{
+    const char *dir = g_getenv("QTEST_PLUGIN_DIR");
+
+    return g_build_filename(dir ? dir : "tests/plugin", name, NULL);
+}
+
+static void plugin_load(QTestState *qts, const char *path)
+{
+    qtest_qmp_assert_success(qts, "{ 'execute': 'plugin-load',"
+                             "  'arguments': { 'file': %s } }", path);
+}
+
+static void plugin_unload(QTestState *qts, const char *path)
+{
+    qtest_qmp_assert_success(qts, "{ 'execute': 'plugin-unload',"
+                             "  'arguments': { 'file': %s } }", path);
+}
+
+static void test_load_unload(const void *data)
+{
+    const char *machine = data;
+    g_autofree char *first = plugin_path(plugins[0]);
+    QTestState *qts;
+    QDict *resp;
+    int i;
+
+    qts = qtest_initf("-accel tcg -machine %s", machine);
+
+    for (i = 0; i < ARRAY_SIZE(plugins); i++) {
+        g_autofree char *path = plugin_path(plugins[i]);
+
+        plugin_load(qts, path);
+        plugin_unload(qts, path);
+    }
+
+    /* unloading again fails, loading again succeeds */
+    resp = qtest_qmp(qts, "{ 'execute': 'plugin-unload',"
+                     "  'arguments': { 'file': %s } }", first);
+    g_assert(qdict_haskey(resp, "error"));
+    qobject_unref(resp);
+    plugin_load(qts, first);
+
+    /* exit with one plugin still loaded, whose atexit runs once */
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_accel("tcg")) {
+        return g_test_run();
+    }
+
+    qtest_add_data_func("/plugin/load-unload/none", "none",
+                        test_load_unload);
+    if (g_str_equal(qtest_get_arch(), "riscv64")) {
+        /* with a vCPU, unloading has to wait for it to leave its TB */
+        qtest_add_data_func("/plugin/load-unload/virt", "virt -bios none",
+                            test_load_unload);
+    }
+
+    return g_test_run();
+}